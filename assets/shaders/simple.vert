@@ -1,50 +1,77 @@
 #version 450
 
-// vertex input
-layout(location = 0) in uint inPackedPositionUV;
-layout(location = 1) in uint inPackedTextureSlotFaceIndex;
-
-layout(location = 0) out vec3 fragWorldPos;
+layout(location = 0) out vec3 fragWorldPos; // relative to the camera
 layout(location = 1) out vec2 fragUV;
 layout(location = 2) flat out uint fragTextureSlot;
 layout(location = 3) flat out vec3 fragNormal;
 
 layout(location = 4) out vec3 debugFragLocalPos; // For debugging
 
+#define CHUNK_SIZE 32
+
 layout(set = 0, binding = 0) uniform global_uniform_object {
-    mat4 view;
-    mat4 projection;
+    mat4 viewProjection; // view rotation only, the camera is at the origin
+    ivec4 cameraChunk;
+    vec4 cameraOffset;   // camera position inside its chunk
     float time;
 } global_ubo;
 
 struct TerrainOUB {
-    mat4 model;
+    ivec4 chunkCoord;
 };
 
 layout(set = 1, binding = 0, std430) readonly buffer object_uniform_buffer {
     TerrainOUB objects[];
 } oub;
 
+// TerrainFace records (render_types.h), 4 vertices per face
+layout(set = 1, binding = 1, std430) readonly buffer face_buffer {
+    uvec2 faces[];
+} faceBuffer;
+
+// Corners of each face (-X, +X, -Y, +Y, -Z, +Z) of a unit voxel, in the order of the quad index buffer
+const uvec3 FACE_CORNERS[24] = uvec3[](
+    uvec3(0, 0, 0), uvec3(0, 1, 0), uvec3(0, 1, 1), uvec3(0, 0, 1),
+    uvec3(1, 0, 0), uvec3(1, 0, 1), uvec3(1, 1, 1), uvec3(1, 1, 0),
+    uvec3(0, 0, 0), uvec3(0, 0, 1), uvec3(1, 0, 1), uvec3(1, 0, 0),
+    uvec3(0, 1, 0), uvec3(1, 1, 0), uvec3(1, 1, 1), uvec3(0, 1, 1),
+    uvec3(0, 0, 0), uvec3(1, 0, 0), uvec3(1, 1, 0), uvec3(0, 1, 0),
+    uvec3(0, 0, 1), uvec3(0, 1, 1), uvec3(1, 1, 1), uvec3(1, 0, 1)
+);
+
 void main() {
-    // Unpack position and UV
-    vec3 inPosition;
-    inPosition.x = (inPackedPositionUV >> 0u) & 0x3FFu;
-    inPosition.y = (inPackedPositionUV >> 10u) & 0x3FFu;
-    inPosition.z = (inPackedPositionUV >> 20u) & 0x3FFu;
+    // the base vertex of the draw points at the first face of the chunk
+    uvec2 face = faceBuffer.faces[uint(gl_VertexIndex) >> 2u];
+    uint corner = uint(gl_VertexIndex) & 3u;
 
-    // UV one bit each (for 4 possible values)
-    fragUV.x = float((inPackedPositionUV >> 30u) & 0x1u);
-    fragUV.y = float((inPackedPositionUV >> 31u) & 0x1u);
+    // Unpack the face
+    uvec3 origin = uvec3(face.x & 0x1Fu, (face.x >> 5u) & 0x1Fu, (face.x >> 10u) & 0x1Fu);
+    uint width = ((face.x >> 15u) & 0x1Fu) + 1u;
+    uint height = ((face.x >> 20u) & 0x1Fu) + 1u;
+    uint faceIndex = (face.x >> 25u) & 0x7u;
+    uint uvRotation = (face.x >> 28u) & 0x3u;
+    uint textureSlot = face.y & 0x1FFFu;
 
-    uint textureSlot = (inPackedTextureSlotFaceIndex >> 0u) & 0x1FFFu;
-    uint faceIndex = (inPackedTextureSlotFaceIndex >> 13u) & 0x7u;
+    // Size of the quad in voxels, 1 along the face normal
+    uint axis = faceIndex / 2u;
+    uvec3 size = uvec3(1u);
+    size[(axis + 1u) % 3u] = width;
+    size[(axis + 2u) % 3u] = height;
 
-    vec3 localPos = inPosition.xyz * (32.0 / 1023.0);
+    vec3 localPos = vec3(origin + FACE_CORNERS[faceIndex * 4u + corner] * size);
     debugFragLocalPos = localPos;
 
-    mat4 model = oub.objects[gl_InstanceIndex].model;
-    vec4 worldPos = model * vec4(localPos, 1.0);
-    fragWorldPos = worldPos.xyz;
+    // Tiling UV in voxels, the sampler repeats the texture on merged quads. The V axis goes down on the vertical faces.
+    uint texUAxis = axis == 0u ? 2u : 0u;
+    uint texVAxis = axis == 1u ? 2u : 1u;
+    uvec3 uvCorner = FACE_CORNERS[faceIndex * 4u + ((corner + uvRotation) & 3u)] * size;
+    fragUV.x = float(uvCorner[texUAxis]);
+    fragUV.y = axis != 1u ? float(size[texVAxis] - uvCorner[texVAxis]) : float(uvCorner[texVAxis]);
+
+    // chunk offset in integers, the float position stays small wherever the camera is
+    ivec3 chunkOffset = (oub.objects[gl_InstanceIndex].chunkCoord.xyz - global_ubo.cameraChunk.xyz) * CHUNK_SIZE;
+    vec3 relativePos = vec3(chunkOffset) + localPos - global_ubo.cameraOffset.xyz;
+    fragWorldPos = relativePos;
 
     vec3 normals[6] = vec3[](
         vec3(-1, 0, 0), vec3(1, 0, 0),   // -X, +X
@@ -55,5 +82,5 @@ void main() {
 
     fragTextureSlot = textureSlot;
 
-    gl_Position = global_ubo.projection * global_ubo.view * worldPos;
-}
\ No newline at end of file
+    gl_Position = global_ubo.viewProjection * vec4(relativePos, 1.0);
+}
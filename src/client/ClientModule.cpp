@@ -5,6 +5,8 @@
 #include "ClientModule.h"
 #include <glm/glm.hpp>
 
+#include "RenderDistanceController.h"
+
 #include "core/GameState.h"
 #include "core/main_components.h"
 #include "core/log/Logger.h"
@@ -71,11 +73,14 @@ ClientModule::ClientModule(flecs::world &ecs) {
             }
         });
 
+    RenderDistanceController::Register(ecs);
+
     ecs.entity("Player")
         .set<Position>({8.0f, 120.0f, 8.0f})
         .set<Camera3dParameters>({
             .fov = 80.0f
         })
+        // initial radius, adjusted by the RenderDistanceController
         .set<ChunkLoader>({
             .loadRadius = 10,
             .unloadRadius = 12
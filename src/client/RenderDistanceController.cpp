@@ -0,0 +1,144 @@
+#include "RenderDistanceController.h"
+
+#include <algorithm>
+#include <fstream>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "core/GameState.h"
+#include "core/log/Logger.h"
+#include "core/world/world_components.h"
+#include "renderer/Renderer.h"
+#include "renderer/rendering_components.h"
+#include "renderer/world/VoxelChunkMesher.h"
+
+void RenderDistanceController::Register(flecs::world &ecs) {
+    ecs.emplace<RenderDistanceController>();
+    auto* controller = ecs.get_mut<RenderDistanceController>();
+
+    ecs.system("RenderDistanceController-Update")
+        .kind(flecs::PreUpdate)
+        .run([controller](flecs::iter& it) {
+            flecs::world world = it.world();
+            const auto* gameState = world.get<GameState>();
+            controller->update_system(world, gameState ? gameState->deltaTime : 0.0);
+        });
+
+    // before the ChunkManager update, it only walks the difference between the old and new spheres
+    ecs.system<ChunkLoader>("RenderDistanceController-ApplyRadius")
+        .kind(flecs::PreUpdate)
+        .with<Camera3d>()
+        .each([controller](ChunkLoader& loader) {
+            controller->apply_radius_system(loader);
+        });
+}
+
+void RenderDistanceController::update_system(flecs::world &world, double deltaTime) {
+    if (m_radius < 0 || deltaTime <= 0.0) return;
+
+    const double frameMs = deltaTime * 1000.0;
+    m_frameMs = m_frameMs == 0.0 ? frameMs : m_frameMs + (frameMs - m_frameMs) * FRAME_TIME_SMOOTHING;
+
+    // let the streaming settle after a change
+    if (m_cooldown > 0.0) {
+        m_cooldown -= deltaTime;
+        return;
+    }
+
+    m_sinceEvaluation += deltaTime;
+    if (m_sinceEvaluation < EVALUATION_INTERVAL) return;
+    m_sinceEvaluation = 0.0;
+
+    const char* reason = nullptr;
+    switch (evaluate(world, reason)) {
+        case Pressure::Over:
+            m_underEvaluations = 0;
+            if (m_radius > m_config.minRadius) {
+                set_radius(m_radius - 1, reason);
+            }
+            break;
+        case Pressure::Within:
+            m_underEvaluations = 0;
+            break;
+        case Pressure::Under:
+            if (++m_underEvaluations >= RAISE_EVALUATIONS && m_radius < m_config.maxRadius) {
+                m_underEvaluations = 0;
+                set_radius(m_radius + 1, "headroom");
+            }
+            break;
+    }
+}
+
+void RenderDistanceController::apply_radius_system(ChunkLoader &loader) {
+    // start from the radius the loader was created with
+    if (m_radius < 0) {
+        m_radius = std::clamp(loader.loadRadius, m_config.minRadius, m_config.maxRadius);
+    }
+
+    loader.loadRadius = m_radius;
+    loader.unloadRadius = m_radius + m_config.unloadMargin;
+}
+
+RenderDistanceController::Pressure RenderDistanceController::evaluate(flecs::world &world, const char*& reason) const {
+    const auto* mesher = world.get<VoxelChunkMesher>();
+    const size_t pendingMeshing = mesher ? mesher->pending_count() : 0;
+
+    float meshMemoryUsage = 0.0f;
+    const auto* renderer = world.get<Renderer>();
+    if (renderer && renderer->voxelTerrainRenderer) {
+        meshMemoryUsage = static_cast<float>(renderer->voxelTerrainRenderer->get_mesh_arena().get_used_face_regions()) /
+                          static_cast<float>(MAX_FACE_REGION);
+    }
+
+    const uint64_t residentBytes = m_config.maxResidentBytes > 0 ? read_resident_bytes() : 0;
+
+    if (m_frameMs > m_config.targetFrameMs) {
+        reason = "frame time";
+        return Pressure::Over;
+    }
+    if (pendingMeshing > m_config.maxPendingMeshing) {
+        reason = "meshing backlog";
+        return Pressure::Over;
+    }
+    if (meshMemoryUsage > m_config.maxMeshMemoryUsage) {
+        reason = "mesh memory";
+        return Pressure::Over;
+    }
+    if (m_config.maxResidentBytes > 0 && residentBytes > m_config.maxResidentBytes) {
+        reason = "resident memory";
+        return Pressure::Over;
+    }
+
+    const bool underLimits =
+        m_frameMs < m_config.targetFrameMs * RAISE_HEADROOM &&
+        static_cast<double>(pendingMeshing) < static_cast<double>(m_config.maxPendingMeshing) * RAISE_HEADROOM &&
+        meshMemoryUsage < m_config.maxMeshMemoryUsage * RAISE_HEADROOM &&
+        (m_config.maxResidentBytes == 0 ||
+         static_cast<double>(residentBytes) < static_cast<double>(m_config.maxResidentBytes) * RAISE_HEADROOM);
+
+    return underLimits ? Pressure::Under : Pressure::Within;
+}
+
+void RenderDistanceController::set_radius(int radius, const char* reason) {
+    LOG_INFO("RenderDistanceController", "Render distance {} -> {} ({}, {:.2f} ms/frame)",
+             m_radius, radius, reason, m_frameMs);
+
+    m_radius = radius;
+    m_cooldown = CHANGE_COOLDOWN;
+}
+
+uint64_t RenderDistanceController::read_resident_bytes() {
+#ifdef __linux__
+    // size and resident pages
+    std::ifstream statm("/proc/self/statm");
+    uint64_t sizePages = 0;
+    uint64_t residentPages = 0;
+    if (!(statm >> sizePages >> residentPages)) return 0;
+
+    return residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <flecs.h>
+
+struct ChunkLoader;
+
+struct RenderDistanceConfig {
+    int minRadius = 4;
+    int maxRadius = 32;
+    int unloadMargin = 2; // unloadRadius = loadRadius + unloadMargin
+
+    double targetFrameMs = 1000.0 / 60.0;
+    // Meshing tasks waiting for a worker
+    size_t maxPendingMeshing = 4096;
+    // Fraction of the terrain mesh arena in use
+    float maxMeshMemoryUsage = 0.9f;
+    // Resident memory of the process, 0 = no limit
+    uint64_t maxResidentBytes = 4ull * 1024 * 1024 * 1024;
+};
+
+/**
+ * Adapts the load radius of the camera chunk loaders to the machine.
+ * Every EVALUATION_INTERVAL seconds the averaged frame time, the meshing backlog, the mesh arena usage and the
+ * resident memory are compared to the config:
+ * - any limit exceeded lowers the radius by one chunk
+ * - everything well under its limit (RAISE_HEADROOM) for RAISE_EVALUATIONS evaluations in a row raises it by one
+ * - in between, the radius is kept
+ * After a change the measures are ignored for CHANGE_COOLDOWN seconds, while the streaming settles.
+ */
+class RenderDistanceController {
+public:
+    static void Register(flecs::world& ecs);
+
+    void set_config(const RenderDistanceConfig& config) { m_config = config; }
+    const RenderDistanceConfig& get_config() const { return m_config; }
+
+    // -1 until the first loader is seen
+    int get_radius() const { return m_radius; }
+
+private:
+    static constexpr double EVALUATION_INTERVAL = 1.0;
+    static constexpr double CHANGE_COOLDOWN = 3.0;
+    static constexpr int RAISE_EVALUATIONS = 3;
+    // Fraction of the limits under which the radius can be raised
+    static constexpr double RAISE_HEADROOM = 0.75;
+    // Weight of the last frame in the averaged frame time
+    static constexpr double FRAME_TIME_SMOOTHING = 0.05;
+
+    enum class Pressure {
+        Over,   // a limit is exceeded
+        Within,
+        Under,  // every measure has headroom
+    };
+
+    RenderDistanceConfig m_config;
+    int m_radius = -1;
+
+    double m_frameMs = 0.0;
+    double m_sinceEvaluation = 0.0;
+    double m_cooldown = 0.0;
+    int m_underEvaluations = 0;
+
+    void update_system(flecs::world& world, double deltaTime);
+    void apply_radius_system(ChunkLoader& loader);
+
+    /**
+     * @param reason Set to the exceeded limit when the result is Over
+     */
+    Pressure evaluate(flecs::world& world, const char*& reason) const;
+    void set_radius(int radius, const char* reason);
+
+    /**
+     * Resident set size of the process (Linux /proc/self/statm), 0 if unknown
+     */
+    static uint64_t read_resident_bytes();
+};
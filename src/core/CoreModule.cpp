@@ -1,10 +1,11 @@
 #include "CoreModule.h"
 #include "GameState.h"
-#include <GLFW/glfw3.h>
 #include <iostream>
 
 #include "main_components.h"
 #include "log/Logger.h"
+#include "task/FrameBudget.h"
+#include "task/TaskScheduler.h"
 #include "world/ChunkManager.h"
 #include "world/world_components.h"
 #include "world/WorldGenerator.h"
@@ -22,9 +23,12 @@ CoreModule::CoreModule(flecs::world& ecs) {
         .assetRegistry = std::move(assetRegistry),
         .isRunning = true,
         .deltaTime = 0.0,
-        .lastTime = glfwGetTime()
+        .lastTime = get_time_seconds()
     });
 
+    TaskScheduler::Register(ecs);
+    FrameBudget::Register(ecs);
+
     ecs.set<WorldGenerator>(WorldGenerator{12345});
     ChunkManager::Register(ecs);
 }
@@ -33,6 +37,14 @@ CoreModule::~CoreModule() = default;
 
 void shutdown_core(flecs::world& ecs) {
     LOG_INFO("CoreModule", "Shutting down...");
+    // after every system submitting tasks has been stopped. Joins the workers, so no generation task is still
+    // reading or writing the region files when the ChunkManager closes them
+    if (auto* scheduler = ecs.get_mut<TaskScheduler>()) {
+        scheduler->shutdown();
+    }
+    if (auto* chunkManager = ecs.get_mut<ChunkManager>()) {
+        chunkManager->shutdown();
+    }
     auto* gameState = ecs.get_mut<GameState>();
     if (gameState && gameState->resourceSystem) {
         gameState->resourceSystem.reset();
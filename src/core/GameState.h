@@ -1,4 +1,5 @@
 #pragma once
+#include <chrono>
 #include <memory>
 
 #include "resource/AssetRegistry.h"
@@ -12,3 +13,10 @@ struct GameState {
     double deltaTime = 0.0;
     double lastTime = 0.0;
 };
+
+/**
+ * Steady time in seconds since an arbitrary origin, the time source of GameState::lastTime
+ */
+inline double get_time_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+/**
+ * Flag shared between the main thread and the tasks it submits, to drop work that is not needed anymore.
+ * The main thread cancels, the task checks is_cancelled() before (or while) doing its work and returns early.
+ * Copies share the same flag. A default constructed token has no flag and is never cancelled.
+ */
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    static CancellationToken create() {
+        CancellationToken token;
+        token.m_cancelled = std::make_shared<std::atomic<bool>>(false);
+        return token;
+    }
+
+    void cancel() const {
+        if (m_cancelled) m_cancelled->store(true, std::memory_order_relaxed);
+    }
+
+    bool is_cancelled() const {
+        return m_cancelled && m_cancelled->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
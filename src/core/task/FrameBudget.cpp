@@ -0,0 +1,59 @@
+#include "FrameBudget.h"
+
+#include <algorithm>
+
+void FrameBudget::Register(flecs::world &ecs) {
+    ecs.emplace<FrameBudget>();
+
+    ecs.system<FrameBudget>("FrameBudget-BeginFrame")
+        .kind(flecs::OnLoad)
+        .each([](FrameBudget& budget) {
+            budget.begin_frame();
+        });
+
+    // registered with the CoreModule, before the PostFrame systems of the other modules (present, shutdown)
+    ecs.system<FrameBudget>("FrameBudget-EndFrame")
+        .kind(flecs::PostFrame)
+        .each([](FrameBudget& budget) {
+            budget.end_frame();
+        });
+}
+
+void FrameBudget::begin_frame() {
+    m_frameStart = std::chrono::steady_clock::now();
+    m_frameStarted = true;
+    m_spentMs = 0.0;
+    m_waitMs = 0.0;
+    for (StageStats& stage : m_stages) {
+        stage.items = 0;
+    }
+}
+
+void FrameBudget::end_frame() {
+    if (!m_frameStarted) return;
+    m_frameStarted = false;
+
+    const std::chrono::duration<double, std::milli> frameTime = std::chrono::steady_clock::now() - m_frameStart;
+    const double otherWorkMs = std::max(0.0, frameTime.count() - m_waitMs - m_spentMs);
+    m_otherWorkMs += (otherWorkMs - m_otherWorkMs) * FRAME_SMOOTHING;
+
+    // the streaming stages get what the rest of the frame leaves of the target
+    const double maxBudgetMs = std::max(MIN_BUDGET_MS, m_targetFrameMs * m_maxBudgetFraction);
+    m_budgetMs = std::clamp(m_targetFrameMs - m_otherWorkMs, MIN_BUDGET_MS, maxBudgetMs);
+}
+
+bool FrameBudget::has_time_for(FrameBudgetStage stage) const {
+    const StageStats& stats = m_stages[static_cast<size_t>(stage)];
+    if (stats.items == 0) return true;
+
+    return m_spentMs + stats.costMs <= m_budgetMs;
+}
+
+void FrameBudget::record(FrameBudgetStage stage, double durationMs) {
+    StageStats& stats = m_stages[static_cast<size_t>(stage)];
+    stats.costMs = stats.items == 0 && stats.costMs == 0.0
+        ? durationMs
+        : stats.costMs + (durationMs - stats.costMs) * COST_SMOOTHING;
+    stats.items++;
+    m_spentMs += durationMs;
+}
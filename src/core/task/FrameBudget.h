@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <flecs.h>
+
+// Main thread streaming work sharing the frame budget
+enum class FrameBudgetStage : uint8_t {
+    ChunkCreation = 0, // chunk entities created from the generation results
+    ChunkUnload,
+    MeshIntake,        // built meshes handed to their chunk
+    MeshUpload,
+    TextureUpload,
+    Count,
+};
+
+static constexpr size_t FRAME_BUDGET_STAGE_COUNT = static_cast<size_t>(FrameBudgetStage::Count);
+
+/**
+ * Milliseconds of main thread time per frame shared by the streaming stages, instead of fixed item counts.
+ * Each stage measures its items and keeps an average cost, an item only runs if its average cost fits in what is
+ * left of the budget. The first item of a stage always runs, so every stage progresses.
+ * The budget follows the frame: it is what the other work of the frame leaves of the target frame time,
+ * clamped between MIN_BUDGET_MS and a fraction of the target frame time. The other work is the CPU time from OnLoad to the start of PostFrame,
+ * minus the streaming stages and the waits reported with add_wait (fences, swapchain). The present and the sleeps
+ * between frames or ticks are outside of it, so an idle frame leaves its slack to the streaming stages.
+ */
+class FrameBudget {
+public:
+    static void Register(flecs::world& ecs);
+
+    /**
+     * Reset the spent time of the frame
+     */
+    void begin_frame();
+
+    /**
+     * Adapt the budget to the CPU time of the frame that ends
+     */
+    void end_frame();
+
+    /**
+     * Account time the main thread spent blocked during the frame, it isn't work of the frame
+     */
+    void add_wait(double durationMs) { m_waitMs += durationMs; }
+
+    /**
+     * Whether one more item of the stage fits in the remaining budget of the frame
+     */
+    bool has_time_for(FrameBudgetStage stage) const;
+
+    /**
+     * Account an item of the stage that took durationMs
+     */
+    void record(FrameBudgetStage stage, double durationMs);
+
+    void set_target_frame_time(double targetFrameMs) { m_targetFrameMs = targetFrameMs; }
+    double get_target_frame_time() const { return m_targetFrameMs; }
+
+    /**
+     * Largest part of the target frame time the streaming stages may use
+     */
+    void set_max_budget_fraction(double fraction) { m_maxBudgetFraction = fraction; }
+
+    double get_budget_ms() const { return m_budgetMs; }
+    double get_spent_ms() const { return m_spentMs; }
+    double get_stage_cost_ms(FrameBudgetStage stage) const { return m_stages[static_cast<size_t>(stage)].costMs; }
+    uint32_t get_stage_items(FrameBudgetStage stage) const { return m_stages[static_cast<size_t>(stage)].items; }
+
+private:
+    static constexpr double MIN_BUDGET_MS = 1.0;
+    static constexpr double DEFAULT_MAX_BUDGET_FRACTION = 0.5;
+    // Weight of the last sample in the averages
+    static constexpr double COST_SMOOTHING = 0.1;
+    static constexpr double FRAME_SMOOTHING = 0.1;
+
+    struct StageStats {
+        double costMs = 0.0; // average duration of one item
+        uint32_t items = 0;  // items run this frame
+    };
+
+    std::array<StageStats, FRAME_BUDGET_STAGE_COUNT> m_stages{};
+
+    double m_targetFrameMs = 1000.0 / 60.0;
+    double m_maxBudgetFraction = DEFAULT_MAX_BUDGET_FRACTION;
+    double m_budgetMs = MIN_BUDGET_MS;
+    double m_spentMs = 0.0;
+    double m_waitMs = 0.0;
+    double m_otherWorkMs = 0.0; // average CPU time of the frame outside of the streaming stages
+
+    std::chrono::steady_clock::time_point m_frameStart;
+    bool m_frameStarted = false;
+};
+
+/**
+ * Measure a wait of the main thread, from construction to destruction
+ */
+class FrameBudgetWaitScope {
+public:
+    explicit FrameBudgetWaitScope(FrameBudget& budget)
+        : m_budget(budget), m_start(std::chrono::steady_clock::now()) {}
+
+    ~FrameBudgetWaitScope() {
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+        m_budget.add_wait(elapsed.count());
+    }
+
+    FrameBudgetWaitScope(const FrameBudgetWaitScope&) = delete;
+    FrameBudgetWaitScope& operator=(const FrameBudgetWaitScope&) = delete;
+
+private:
+    FrameBudget& m_budget;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ * Measure one item of a stage, from construction to destruction
+ */
+class FrameBudgetScope {
+public:
+    FrameBudgetScope(FrameBudget& budget, FrameBudgetStage stage)
+        : m_budget(budget), m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+
+    ~FrameBudgetScope() {
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+        m_budget.record(m_stage, elapsed.count());
+    }
+
+    FrameBudgetScope(const FrameBudgetScope&) = delete;
+    FrameBudgetScope& operator=(const FrameBudgetScope&) = delete;
+
+private:
+    FrameBudget& m_budget;
+    FrameBudgetStage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
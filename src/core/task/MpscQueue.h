@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+/**
+ * Unbounded lock-free multi-producer single-consumer queue (Dmitry Vyukov's node based queue).
+ * push() is wait-free and can be called from any thread, pop() must always be called from the same consumer thread.
+ * A pop() can miss an element whose push() is still in progress, it will be returned by a later pop().
+ */
+template<typename T>
+class MpscQueue {
+public:
+    MpscQueue() {
+        Node* stub = new Node();
+        m_head.store(stub, std::memory_order_relaxed);
+        m_tail = stub;
+    }
+
+    ~MpscQueue() {
+        while (pop()) {}
+        delete m_tail;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node();
+        node->value.emplace(std::move(value));
+
+        m_size.fetch_add(1, std::memory_order_relaxed);
+        Node* previous = m_head.exchange(node, std::memory_order_acq_rel);
+        // from here until the store, the consumer sees the queue as ending at `previous`
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    std::optional<T> pop() {
+        Node* tail = m_tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) return std::nullopt;
+
+        // `next` becomes the new stub, its value is moved out
+        std::optional<T> value = std::move(next->value);
+        next->value.reset();
+        m_tail = next;
+        delete tail;
+
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+        return value;
+    }
+
+    /**
+     * Approximate number of elements, can be off while pushes/pops are in progress
+     */
+    size_t size_approx() const { return m_size.load(std::memory_order_relaxed); }
+
+private:
+    struct Node {
+        std::atomic<Node*> next = nullptr;
+        std::optional<T> value;
+    };
+
+    alignas(64) std::atomic<Node*> m_head; // last pushed node, shared by the producers
+    alignas(64) Node* m_tail;              // stub node before the next element, only touched by the consumer
+    alignas(64) std::atomic<size_t> m_size = 0;
+};
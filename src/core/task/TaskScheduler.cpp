@@ -0,0 +1,185 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <exception>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "core/log/Logger.h"
+
+namespace {
+    // Worker running on the current thread, to push the tasks it submits in its own deques
+    thread_local const TaskScheduler* t_currentScheduler = nullptr;
+    thread_local size_t t_currentWorker = 0;
+}
+
+TaskScheduler::~TaskScheduler() {
+    shutdown();
+}
+
+void TaskScheduler::start(const TaskSchedulerConfig &config) {
+    if (!m_workers.empty()) return;
+
+    const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t workerCount = config.workerCount;
+    if (workerCount == 0) {
+        workerCount = hardwareThreads > config.reservedCores ? hardwareThreads - config.reservedCores : 1;
+    }
+
+    m_stop = false;
+    m_workers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; i++) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+
+    // start the threads once every deque exists, the workers steal from each other right away
+    for (size_t i = 0; i < workerCount; i++) {
+        const int pinnedCore = config.pinWorkers ? static_cast<int>((config.reservedCores + i) % hardwareThreads) : -1;
+        m_workers[i]->thread = std::thread([this, i, pinnedCore] { worker_loop(i, pinnedCore); });
+    }
+
+    LOG_INFO("TaskScheduler", "Started {} workers ({} hardware threads, {} reserved{})",
+             workerCount, hardwareThreads, config.reservedCores, config.pinWorkers ? ", pinned" : "");
+}
+
+void TaskScheduler::shutdown() {
+    if (m_workers.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_sleepCv.notify_all();
+
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    size_t droppedTasks = m_pendingTasks.exchange(0);
+    m_workers.clear();
+    LOG_INFO("TaskScheduler", "All workers shut down ({} tasks dropped)", droppedTasks);
+}
+
+void TaskScheduler::submit(Task task, TaskPriority priority) {
+    if (m_workers.empty()) {
+        task();
+        return;
+    }
+
+    const size_t target = t_currentScheduler == this
+        ? t_currentWorker
+        : m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+    // counted before it is visible to the workers, so a worker taking it can't decrement the count first
+    m_pendingTasks.fetch_add(1);
+    {
+        Worker& worker = *m_workers[target];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queues[static_cast<size_t>(priority)].push_back(std::move(task));
+    }
+
+    // Only touch the sleep mutex when a worker may be waiting on it
+    if (m_sleepingWorkers.load() > 0) {
+        { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+        m_sleepCv.notify_one();
+    }
+}
+
+void TaskScheduler::worker_loop(size_t index, int pinnedCore) {
+    t_currentScheduler = this;
+    t_currentWorker = index;
+    if (pinnedCore >= 0) {
+        pin_current_thread(pinnedCore);
+    }
+    LOG_DEBUG("TaskScheduler", "Worker {} started", index);
+
+    while (true) {
+        Task task;
+        if (find_task(index, task)) {
+            try {
+                task();
+            } catch (const std::exception& e) {
+                LOG_ERROR("TaskScheduler", "Task failed on worker {}: {}", index, e.what());
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_sleepingWorkers.fetch_add(1);
+        m_sleepCv.wait(lock, [this] {
+            return m_stop || m_pendingTasks.load() > 0;
+        });
+        m_sleepingWorkers.fetch_sub(1);
+
+        if (m_stop) {
+            LOG_DEBUG("TaskScheduler", "Worker {} stopping", index);
+            return;
+        }
+    }
+}
+
+bool TaskScheduler::find_task(size_t workerIndex, Task &outTask) {
+    for (size_t priority = 0; priority < TASK_PRIORITY_COUNT; priority++) {
+        if (pop_local(workerIndex, priority, outTask) || steal(workerIndex, priority, outTask)) {
+            m_pendingTasks.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskScheduler::pop_local(size_t workerIndex, size_t priority, Task &outTask) {
+    Worker& worker = *m_workers[workerIndex];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+
+    auto& queue = worker.queues[priority];
+    if (queue.empty()) return false;
+
+    // newest first, its data is the most likely to still be in cache
+    outTask = std::move(queue.back());
+    queue.pop_back();
+    return true;
+}
+
+bool TaskScheduler::steal(size_t thiefIndex, size_t priority, Task &outTask) {
+    const size_t workerCount = m_workers.size();
+    for (size_t offset = 1; offset < workerCount; offset++) {
+        Worker& victim = *m_workers[(thiefIndex + offset) % workerCount];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock()) continue; // busy, try the next one
+
+        auto& queue = victim.queues[priority];
+        if (queue.empty()) continue;
+
+        // oldest first, the opposite end of the owner
+        outTask = std::move(queue.front());
+        queue.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void TaskScheduler::pin_current_thread(int core) {
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0) {
+        LOG_WARN("TaskScheduler", "Failed to pin a worker to core {}", core);
+    }
+#else
+    (void)core;
+#endif
+}
+
+void TaskScheduler::Register(flecs::world &ecs) {
+    const auto* config = ecs.get<TaskSchedulerConfig>();
+
+    ecs.emplace<TaskScheduler>();
+    ecs.get_mut<TaskScheduler>()->start(config ? *config : TaskSchedulerConfig{});
+}
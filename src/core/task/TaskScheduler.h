@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <flecs.h>
+
+enum class TaskPriority {
+    High = 0,   // needed for the current frame (meshing of visible chunks...)
+    Normal = 1,
+    Low = 2,    // background work that can wait (prefetching, saving...)
+};
+
+static constexpr size_t TASK_PRIORITY_COUNT = 3;
+
+// Set as a singleton before importing the CoreModule to change the defaults
+struct TaskSchedulerConfig {
+    // Worker threads to start, 0 = one per hardware thread not reserved
+    size_t workerCount = 0;
+    // Hardware threads left to the main thread (and the driver threads), not used by the workers
+    size_t reservedCores = 1;
+    // Pin each worker to its own core, after the reserved ones (Linux only)
+    bool pinWorkers = false;
+};
+
+/**
+ * Engine-wide pool of worker threads running the background work (generation, meshing, I/O).
+ * Each worker owns one deque per priority. Tasks submitted from a worker go to its own deques, tasks submitted from
+ * other threads are spread across the workers. An idle worker takes its own newest task first, then steals the
+ * oldest task of the other workers, always going through the priorities from High to Low.
+ */
+class TaskScheduler {
+public:
+    using Task = std::function<void()>;
+
+    TaskScheduler() = default;
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    void start(const TaskSchedulerConfig& config);
+
+    /**
+     * Stop the workers once their current task is done. Tasks not started yet are dropped.
+     */
+    void shutdown();
+
+    /**
+     * Queue a task. If the scheduler is not started, the task is run right away on the calling thread.
+     */
+    void submit(Task task, TaskPriority priority = TaskPriority::Normal);
+
+    size_t worker_count() const { return m_workers.size(); }
+
+    /**
+     * Number of tasks queued and not started yet
+     */
+    size_t pending_count() const { return m_pendingTasks.load(std::memory_order_relaxed); }
+
+    /**
+     * Create the scheduler singleton and start it with the TaskSchedulerConfig singleton, or the defaults if unset
+     */
+    static void Register(flecs::world& ecs);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[TASK_PRIORITY_COUNT];
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::atomic<size_t> m_nextWorker = 0; // round robin for the tasks submitted from outside the workers
+    std::atomic<size_t> m_pendingTasks = 0;
+    std::atomic<bool> m_stop = false;
+
+    // Only used to put the idle workers to sleep
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCv;
+    std::atomic<size_t> m_sleepingWorkers = 0;
+
+    void worker_loop(size_t index, int pinnedCore);
+
+    bool find_task(size_t workerIndex, Task& outTask);
+    bool pop_local(size_t workerIndex, size_t priority, Task& outTask);
+    bool steal(size_t thiefIndex, size_t priority, Task& outTask);
+
+    static void pin_current_thread(int core);
+};
@@ -0,0 +1,82 @@
+#include "ChunkGenerationPool.h"
+
+#include <algorithm>
+
+#include "RegionFileStore.h"
+#include "WorldGenerator.h"
+#include "core/task/TaskScheduler.h"
+
+ChunkGenerationPool::ChunkGenerationPool(TaskScheduler* scheduler, const WorldGenerator* generator,
+                                         RegionFileStore* store)
+    : m_scheduler(scheduler), m_generator(generator), m_store(store) {}
+
+ChunkGenerationPool::~ChunkGenerationPool() {
+    shutdown();
+}
+
+void ChunkGenerationPool::shutdown() {
+    m_stop = true;
+}
+
+void ChunkGenerationPool::submit(const glm::ivec3 &chunkCoord, uint32_t generation, CancellationToken cancellation,
+                                 TaskPriority priority) {
+    m_inFlight.fetch_add(1, std::memory_order_relaxed);
+    m_scheduler->submit([this, chunkCoord, generation, cancellation = std::move(cancellation)] {
+        generate(chunkCoord, generation, cancellation);
+    }, priority);
+}
+
+std::optional<ChunkGenerationResult> ChunkGenerationPool::poll_result() {
+    std::lock_guard<std::mutex> lock(m_resultMutex);
+    if (m_resultQueue.empty()) return std::nullopt;
+
+    std::optional<ChunkGenerationResult> result = std::move(m_resultQueue.front());
+    m_resultQueue.pop();
+    m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+
+    return result;
+}
+
+void ChunkGenerationPool::generate(const glm::ivec3 &chunkCoord, uint32_t generation,
+                                   const CancellationToken &cancellation) {
+    // nobody will consume the result anymore
+    if (m_stop) {
+        m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // the chunk was released while this task was waiting
+    if (cancellation.is_cancelled()) {
+        m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ChunkGenerationResult result;
+    result.chunkCoord = chunkCoord;
+    result.generation = generation;
+
+    RegionLoadResult stored = m_store ? m_store->load(chunkCoord, *result.chunk.voxels) : RegionLoadResult::Missing;
+    result.fromStore = stored != RegionLoadResult::Missing;
+    if (stored == RegionLoadResult::Loaded) {
+        result.chunk.textureIDs = m_generator->get_texture_table();
+        result.hasContent = !(result.chunk.voxels->is_uniform() && result.chunk.voxels->get_uniform_value() == 0);
+    } else if (stored == RegionLoadResult::Empty) {
+        result.hasContent = false;
+    } else {
+        result.hasContent = m_generator->generate_chunk(result.chunk, chunkCoord);
+        if (m_store) {
+            m_store->save(chunkCoord, *result.chunk.voxels);
+        }
+    }
+
+    // released while it was generated, it is in the store for the next time it is needed
+    if (cancellation.is_cancelled()) {
+        m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_resultMutex);
+        m_resultQueue.push(std::move(result));
+    }
+}
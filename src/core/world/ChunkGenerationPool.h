@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "world_components.h"
+#include "core/task/CancellationToken.h"
+#include "core/task/TaskScheduler.h"
+
+class WorldGenerator;
+class RegionFileStore;
+
+struct ChunkGenerationResult {
+    glm::ivec3 chunkCoord;
+    uint32_t generation = 0; // as submitted
+    VoxelChunk chunk;
+
+    bool hasContent = false;
+    bool fromStore = false; // read from the region store instead of generated
+};
+
+/**
+ * Runs the world generator off the main thread, as tasks of the TaskScheduler.
+ * Chunk coordinates are submitted by the ChunkManager, and the generated chunks are
+ * polled back on the main thread to create the chunk entities.
+ * Chunks already saved in the region store are read from it, newly generated ones are written to it.
+ */
+class ChunkGenerationPool {
+public:
+    ChunkGenerationPool(TaskScheduler* scheduler, const WorldGenerator* generator, RegionFileStore* store);
+    ~ChunkGenerationPool();
+
+    /**
+     * Stop generating. The tasks still queued in the scheduler return without doing anything, the ones already
+     * running finish: join the scheduler before closing the region store.
+     */
+    void shutdown();
+
+    /**
+     * Generate a chunk on a worker
+     * @param generation Returned in the result, to recognize the results of a chunk queued again since
+     * @param cancellation The task returns without result if it is cancelled before it starts generating
+     */
+    void submit(const glm::ivec3& chunkCoord, uint32_t generation, CancellationToken cancellation,
+                TaskPriority priority = TaskPriority::Normal);
+
+    /**
+     * Take the oldest generated chunk, if any
+     */
+    std::optional<ChunkGenerationResult> poll_result();
+
+    /**
+     * Number of chunks submitted but not yet polled back or cancelled (queued, generating or waiting in the result
+     * queue)
+     */
+    size_t in_flight_count() const { return m_inFlight.load(std::memory_order_relaxed); }
+
+private:
+    void generate(const glm::ivec3& chunkCoord, uint32_t generation, const CancellationToken& cancellation);
+
+    TaskScheduler* m_scheduler;
+    const WorldGenerator* m_generator;
+    RegionFileStore* m_store; // can be null
+
+    // result queue output
+    mutable std::mutex m_resultMutex;
+    std::queue<ChunkGenerationResult> m_resultQueue;
+
+    std::atomic<size_t> m_inFlight = 0;
+    std::atomic<bool> m_stop = false;
+};
@@ -1,21 +1,82 @@
 #include "ChunkManager.h"
 
 #include <algorithm>
-#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <functional>
 
 #include "WorldGenerator.h"
-#include "platform/inputs/input_state.h"
+#include "core/GameState.h"
+#include "core/log/Logger.h"
+#include "core/task/TaskScheduler.h"
 
-struct InputActionState;
+namespace {
+    // Largest h with h * h <= value
+    int isqrt(int value) {
+        int root = static_cast<int>(std::sqrt(static_cast<float>(value)));
+        while (root * root > value) root--;
+        while ((root + 1) * (root + 1) <= value) root++;
+        return root;
+    }
+
+    /**
+     * Call fn for every chunk of the sphere (center, radius) outside of the sphere (excludedCenter, excludedRadius).
+     * The sphere is walked column by column and only the z intervals out of the excluded sphere are visited,
+     * so a loader moving by one chunk costs O(r^2) instead of O(r^3).
+     * @param hasExcluded False to visit the whole sphere
+     */
+    template <typename Fn>
+    void for_each_sphere_difference(const glm::ivec3& center, int radius,
+                                    const glm::ivec3& excludedCenter, int excludedRadius, bool hasExcluded, Fn&& fn) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            for (int dy = -radius; dy <= radius; dy++) {
+                const int remaining = radius * radius - dx * dx - dy * dy;
+                if (remaining < 0) continue;
+
+                const int x = center.x + dx;
+                const int y = center.y + dy;
+                const int halfHeight = isqrt(remaining);
+                const int zMin = center.z - halfHeight;
+                const int zMax = center.z + halfHeight;
+
+                // same column in the excluded sphere
+                const int ex = x - excludedCenter.x;
+                const int ey = y - excludedCenter.y;
+                const int excludedRemaining = excludedRadius * excludedRadius - ex * ex - ey * ey;
+                if (!hasExcluded || excludedRemaining < 0) {
+                    for (int z = zMin; z <= zMax; z++) fn(glm::ivec3(x, y, z));
+                    continue;
+                }
+
+                const int excludedHalfHeight = isqrt(excludedRemaining);
+                const int excludedMin = excludedCenter.z - excludedHalfHeight;
+                const int excludedMax = excludedCenter.z + excludedHalfHeight;
+                for (int z = zMin; z <= std::min(zMax, excludedMin - 1); z++) fn(glm::ivec3(x, y, z));
+                for (int z = std::max(zMin, excludedMax + 1); z <= zMax; z++) fn(glm::ivec3(x, y, z));
+            }
+        }
+    }
+}
 
 void ChunkManager::init(flecs::world &ecs) {
+    m_regionStore = std::make_unique<RegionFileStore>(REGION_DIRECTORY);
+    m_generationPool = std::make_unique<ChunkGenerationPool>(ecs.get_mut<TaskScheduler>(), ecs.get<WorldGenerator>(),
+                                                             m_regionStore.get());
+    m_frameBudget = ecs.get_mut<FrameBudget>();
+
     // register systems
     ecs.system<ChunkLoader, const Position>("ChunkManager-UpdateLoadQueueSystem")
         .kind(flecs::OnUpdate)
         .each([this](flecs::entity e, ChunkLoader& loader, const Position& position) {
-            const auto* inputState = e.world().get<InputActionState>();
-            if (inputState->is_action_pressed(ActionInputType::Debug1)) {
-                this->load_chunks_at_radius({0,0,0}, 8);
+            this->update_desired_chunk_system(e, loader, position);
+        });
+
+    ecs.observer<const ChunkLoader>("ChunkManager-ReleaseLoaderObserver")
+        .event(flecs::OnRemove)
+        .each([](flecs::entity e, const ChunkLoader& loader) {
+            if (e.world().is_fini()) return;
+            if (auto* chunkManager = e.world().get_mut<ChunkManager>()) {
+                chunkManager->release_loader(loader);
             }
         });
 
@@ -33,91 +94,234 @@ void ChunkManager::init(flecs::world &ecs) {
 
 }
 
-void ChunkManager::load_chunks_at_radius(const ChunkCoordinate &center, int radius) {
-    for (int x = -radius; x <= radius; x++) {
-        for (int y = -radius; y <= radius; y++) {
-            for (int z = -radius; z <= radius; z++) {
-                glm::ivec3 chunkPos = glm::ivec3(center.x + x, center.y + y, center.z + z);
-                if (!is_chunk_processed(chunkPos)) {
-                    if (!m_loadingChunks.contains(chunkPos)) {
-                        m_loadQueue.push_back(chunkPos);
-                        m_loadingChunks.insert(chunkPos);
-                    }
-                }
-            }
-        }
+void ChunkManager::queue_load(const glm::ivec3 &chunkPos, float priority) {
+    // already queued, generating or loaded
+    auto [it, inserted] = m_chunks.try_emplace(chunkPos);
+    if (!inserted) return;
+
+    it->second.generation = ++m_nextGeneration;
+    m_loadQueue.push_back({chunkPos, priority, it->second.generation});
+    std::push_heap(m_loadQueue.begin(), m_loadQueue.end(), std::greater<>());
+}
+
+void ChunkManager::queue_unload(const glm::ivec3 &chunkPos) {
+    auto it = m_chunks.find(chunkPos);
+    if (it == m_chunks.end() || it->second.state != ChunkState::Generated) return;
+
+    it->second.state = ChunkState::Unloading;
+    m_unloadQueue.push_back(chunkPos);
+}
+
+void ChunkManager::retain_chunk(const glm::ivec3 &chunkPos) {
+    m_chunkRefs[chunkPos]++;
+}
+
+void ChunkManager::release_chunk(const glm::ivec3 &chunkPos) {
+    auto it = m_chunkRefs.find(chunkPos);
+    if (it == m_chunkRefs.end() || --it->second != 0) return;
+    m_chunkRefs.erase(it);
+
+    // Not generated yet: drop it. Its load request and generation result are stale once the record is gone.
+    auto record = m_chunks.find(chunkPos);
+    if (record != m_chunks.end() && !is_generated(record->second)) {
+        record->second.cancellation.cancel();
+        m_chunks.erase(record);
     }
 }
 
-void ChunkManager::update_desired_chunk_system(flecs::entity e, ChunkLoader &loader, const Position &position) {
-    glm::ivec3 centerChunkPos = world_pos_to_chunk_pos(glm::vec3(position.x, position.y, position.z));
+void ChunkManager::release_loader(const ChunkLoader &loader) {
+    if (!loader.has_visited()) return;
 
-    // do nothing if the center chunk hasn't changed
-    if (loader.has_visited() && centerChunkPos == loader.lastVisitedChunk) return;
+    const glm::ivec3 center = loader.lastVisitedChunk;
+    for_each_sphere_difference(center, loader.lastLoadRadius, center, 0, false,
+        [&](const glm::ivec3& chunkPos) {
+            release_chunk(chunkPos);
+        });
+    for_each_sphere_difference(center, loader.lastUnloadRadius, center, 0, false,
+        [&](const glm::ivec3& chunkPos) {
+            queue_unload(chunkPos);
+        });
 
-    loader.desiredChunks.clear();
+    if (loader.lastPrefetchRadius >= 0) {
+        for_each_sphere_difference(loader.lastPrefetchChunk, loader.lastPrefetchRadius, center, 0, false,
+            [&](const glm::ivec3& chunkPos) {
+                release_chunk(chunkPos);
+                queue_unload(chunkPos);
+            });
+    }
+}
 
-    for (int x = -loader.loadRadius; x <= loader.loadRadius; x++) {
-        for (int y = -loader.loadRadius; y <= loader.loadRadius; y++) {
-            for (int z = -loader.loadRadius; z <= loader.loadRadius; z++) {
-                glm::ivec3 chunkPos = centerChunkPos + glm::ivec3(x, y, z);
-                loader.desiredChunks.insert(chunkPos);
-            }
+void ChunkManager::update_desired_chunk_system(flecs::entity e, ChunkLoader &loader, const Position &position) {
+    if (const auto* orientation = e.get<Orientation>()) {
+        const float pitchRad = glm::radians(orientation->pitch);
+        const float yawRad = glm::radians(orientation->yaw);
+        loader.viewDirection = glm::vec3(
+            cos(pitchRad) * sin(yawRad),
+            sin(pitchRad),
+            cos(pitchRad) * cos(yawRad));
+    }
+
+    const glm::vec3 worldPos = glm::vec3(position.x, position.y, position.z);
+
+    // velocity of the entity if it has one, else derived from the movement since the last frame
+    glm::vec3 velocity = glm::vec3(0.0f);
+    if (const auto* entityVelocity = e.get<Velocity>()) {
+        velocity = glm::vec3(*entityVelocity);
+    } else if (loader.has_visited()) {
+        const auto* gameState = e.world().get<GameState>();
+        if (gameState && gameState->deltaTime > 0.0) {
+            velocity = (worldPos - loader.lastPosition) / static_cast<float>(gameState->deltaTime);
         }
     }
+    loader.velocity += (velocity - loader.velocity) * VELOCITY_SMOOTHING;
+    loader.lastPosition = worldPos;
+
+    update_load_spheres(loader, world_pos_to_chunk_pos(worldPos));
+    update_prefetch_sphere(loader, worldPos);
+}
+
+void ChunkManager::update_load_spheres(ChunkLoader &loader, const glm::ivec3 &centerChunkPos) {
+    // do nothing if the center chunk and the radii haven't changed
+    if (loader.has_visited() && centerChunkPos == loader.lastVisitedChunk &&
+        loader.loadRadius == loader.lastLoadRadius && loader.unloadRadius == loader.lastUnloadRadius) return;
+
+    const bool visited = loader.has_visited();
+    const glm::ivec3 previousChunkPos = loader.lastVisitedChunk;
+    const int previousLoadRadius = loader.lastLoadRadius;
+    const int previousUnloadRadius = loader.lastUnloadRadius;
+    const glm::vec3 travelDirection = travel_direction(loader);
 
     loader.lastVisitedChunk = centerChunkPos;
+    loader.lastLoadRadius = loader.loadRadius;
+    loader.lastUnloadRadius = loader.unloadRadius;
 
-    // update queues
-    // find chunks that are desired but not loaded
-    for (const auto& chunkPos : loader.desiredChunks) {
-        if (!is_chunk_processed(chunkPos)) {
-            // not loaded, add to load queue if not already loading
-            if (!m_loadingChunks.contains(chunkPos)) {
-                m_loadQueue.push_back(chunkPos);
-                m_loadingChunks.insert(chunkPos);
-            }
-        }
+    // Chunks entering the load sphere
+    for_each_sphere_difference(centerChunkPos, loader.loadRadius, previousChunkPos, previousLoadRadius, visited,
+        [&](const glm::ivec3& chunkPos) {
+            retain_chunk(chunkPos);
+            queue_load(chunkPos, loader_priority(chunkPos, centerChunkPos, loader.viewDirection, travelDirection));
+        });
+
+    if (!visited) return;
+
+    // Chunks leaving the load sphere lose the reference of this loader, they stay loaded until they leave the
+    // unload sphere
+    for_each_sphere_difference(previousChunkPos, previousLoadRadius, centerChunkPos, loader.loadRadius, true,
+        [&](const glm::ivec3& chunkPos) {
+            release_chunk(chunkPos);
+        });
+
+    // Chunks leaving the unload sphere
+    for_each_sphere_difference(previousChunkPos, previousUnloadRadius, centerChunkPos, loader.unloadRadius, true,
+        [&](const glm::ivec3& chunkPos) {
+            queue_unload(chunkPos);
+        });
+}
+
+void ChunkManager::update_prefetch_sphere(ChunkLoader &loader, const glm::vec3 &position) {
+    const glm::vec3 travelDirection = travel_direction(loader);
+
+    glm::ivec3 prefetchChunkPos = loader.lastVisitedChunk;
+    int prefetchRadius = -1;
+    if (travelDirection != glm::vec3(0.0f)) {
+        const float lookAhead = std::min(glm::length(loader.velocity) * PREFETCH_LOOKAHEAD_SECONDS,
+                                         static_cast<float>(loader.loadRadius * CHUNK_SIZE));
+        prefetchChunkPos = world_pos_to_chunk_pos(position + travelDirection * lookAhead);
+        prefetchRadius = std::max(1, loader.loadRadius / 3);
     }
 
-    // Find chunks to unload (loaded but outside unload radius)
-    glm::ivec3 centerPos = loader.lastVisitedChunk;
-    std::vector<glm::ivec3> chunksToUnload;
+    if (prefetchChunkPos == loader.lastPrefetchChunk && prefetchRadius == loader.lastPrefetchRadius) return;
 
-    for (auto& [chunkPos, chunkEntity] : m_loadedChunks) {
-        // Check if this chunk is loaded by this loader
-        //if (!chunkEntity.has<LoadedBy>(e)) continue;
+    const bool hadPrefetch = loader.lastPrefetchRadius >= 0;
+    const bool hasPrefetch = prefetchRadius >= 0;
+    const glm::ivec3 previousChunkPos = loader.lastPrefetchChunk;
+    const int previousRadius = loader.lastPrefetchRadius;
 
-        glm::ivec3 delta = chunkPos - centerPos;
-        float distSq = delta.x*delta.x + delta.y*delta.y + delta.z*delta.z;
+    loader.lastPrefetchChunk = prefetchChunkPos;
+    loader.lastPrefetchRadius = prefetchRadius;
 
-        if (distSq > loader.unloadRadius * loader.unloadRadius) {
-            chunksToUnload.push_back(chunkPos);
-        }
+    if (hasPrefetch) {
+        for_each_sphere_difference(prefetchChunkPos, prefetchRadius, previousChunkPos, previousRadius, hadPrefetch,
+            [&](const glm::ivec3& chunkPos) {
+                retain_chunk(chunkPos);
+                queue_load(chunkPos, loader_priority(chunkPos, loader.lastVisitedChunk, loader.viewDirection,
+                                                     travelDirection));
+            });
     }
 
-    for (const auto& chunkPos : chunksToUnload) {
-        if (std::ranges::find(m_unloadQueue, chunkPos) == m_unloadQueue.end()) {
-            m_unloadQueue.push_back(chunkPos);
-        }
+    // The chunks left behind inside the unload sphere stay loaded, they are unloaded when they leave it like the
+    // chunks of the load sphere. The unload queue skips the ones still referenced.
+    if (hadPrefetch) {
+        for_each_sphere_difference(previousChunkPos, previousRadius, prefetchChunkPos, prefetchRadius, hasPrefetch,
+            [&](const glm::ivec3& chunkPos) {
+                release_chunk(chunkPos);
+                if (!is_within_sphere(loader.lastVisitedChunk, chunkPos, loader.unloadRadius)) {
+                    queue_unload(chunkPos);
+                }
+            });
     }
 }
 
 void ChunkManager::process_load_queue_system(flecs::iter &it) {
-    WorldGenerator* generator = it.world().get_mut<WorldGenerator>();
-    int chunksLoaded = 0;
+    m_loaderViews.clear();
+    it.world().each<const ChunkLoader>([&](const ChunkLoader& loader) {
+        if (loader.has_visited()) {
+            m_loaderViews.push_back({loader.lastVisitedChunk, loader.viewDirection, travel_direction(loader)});
+        }
+    });
 
-    while (!m_loadQueue.empty() && chunksLoaded < MAX_CHUNKS_PER_FRAME) {
-        glm::ivec3 chunkPos = m_loadQueue.front();
-        m_loadQueue.erase(m_loadQueue.begin());
+    // Hand the closest queued chunks to the generation workers
+    while (!m_loadQueue.empty() && m_generationPool->in_flight_count() < MAX_GENERATIONS_IN_FLIGHT) {
+        std::pop_heap(m_loadQueue.begin(), m_loadQueue.end(), std::greater<>());
+        LoadRequest request = m_loadQueue.back();
+        m_loadQueue.pop_back();
+
+        // Skip the requests of the chunks released (and maybe queued again) since
+        auto record = m_chunks.find(request.chunkPos);
+        if (record == m_chunks.end() || record->second.generation != request.generation ||
+            record->second.state != ChunkState::Queued) {
+            continue;
+        }
 
-        // Skip if already processed (safety check)
-        if (is_chunk_processed(chunkPos)) {
+        // The priority was computed when the chunk was queued, the loaders may have moved or turned since.
+        // Requeue it if it is now behind the next request, it is popped again with its current priority.
+        const float priority = load_priority(request.chunkPos);
+        if (priority > request.priority && !m_loadQueue.empty() && priority > m_loadQueue.front().priority) {
+            m_loadQueue.push_back({request.chunkPos, priority, request.generation});
+            std::push_heap(m_loadQueue.begin(), m_loadQueue.end(), std::greater<>());
             continue;
         }
 
-        VoxelChunk chunkData = {};
-        if (generator->generate_chunk(chunkData, chunkPos)) {
+        record->second.state = ChunkState::Generating;
+        record->second.cancellation = CancellationToken::create();
+        m_generationPool->submit(request.chunkPos, request.generation, record->second.cancellation,
+                                 to_task_priority(priority));
+    }
+
+    // Create the entities of the chunks generated since the last frame, within the frame budget
+    while (m_frameBudget->has_time_for(FrameBudgetStage::ChunkCreation)) {
+        std::optional<ChunkGenerationResult> result = m_generationPool->poll_result();
+        if (!result) break;
+
+        FrameBudgetScope budgetScope(*m_frameBudget, FrameBudgetStage::ChunkCreation);
+        const glm::ivec3 chunkPos = result->chunkCoord;
+
+        // late result of a chunk released while it was generated
+        auto record = m_chunks.find(chunkPos);
+        if (record == m_chunks.end() || record->second.generation != result->generation ||
+            record->second.state != ChunkState::Generating) {
+            continue;
+        }
+
+        record->second.state = ChunkState::Generated;
+        record->second.cancellation = {};
+        if (result->fromStore) {
+            m_loadedCount++;
+        } else {
+            m_generatedCount++;
+        }
+
+        if (result->hasContent) {
             auto chunk = it.world().entity()
                 .set<ChunkCoordinate>(chunkPos)
                 .set<Position>({
@@ -125,56 +329,99 @@ void ChunkManager::process_load_queue_system(flecs::iter &it) {
                     static_cast<float>(chunkPos.y * CHUNK_SIZE),
                     static_cast<float>(chunkPos.z * CHUNK_SIZE)
                 })
-                .set<VoxelChunk>(chunkData);
+                .set<VoxelChunk>(std::move(result->chunk));
 
-            m_loadedChunks[chunkPos] = chunk;
-        } else {
-            m_emptyChunks.insert(chunkPos);
+            record->second.entity = chunk;
         }
-
-        chunksLoaded++;
     }
 }
 
 void ChunkManager::process_unload_queue_system(flecs::iter &it) {
-    int chunksUnloaded = 0;
-
-    while (!m_unloadQueue.empty() && chunksUnloaded < MAX_CHUNKS_PER_FRAME) {
+    while (!m_unloadQueue.empty() && m_frameBudget->has_time_for(FrameBudgetStage::ChunkUnload)) {
         glm::ivec3 chunkPos = m_unloadQueue.front();
-        m_unloadQueue.erase(m_unloadQueue.begin());
-
-        auto loadedIt = m_loadedChunks.find(chunkPos);
-        if (loadedIt != m_loadedChunks.end()) {
-            if (!is_chunk_still_needed(chunkPos, it)) {
-                it.world().entity(loadedIt->second).destruct();
-                m_loadedChunks.erase(loadedIt);
-                chunksUnloaded++;
-            }
-        } else {
-            auto emptyIt = m_emptyChunks.find(chunkPos);
-            if (emptyIt != m_emptyChunks.end()) {
-                if (!is_chunk_still_needed(chunkPos, it)) {
-                    m_emptyChunks.erase(emptyIt);
-                    chunksUnloaded++;
-                }
-            }
+        m_unloadQueue.pop_front();
+
+        auto record = m_chunks.find(chunkPos);
+        if (record == m_chunks.end() || record->second.state != ChunkState::Unloading) continue;
+
+        // a loader came back
+        if (is_chunk_still_needed(chunkPos)) {
+            record->second.state = ChunkState::Generated;
+            continue;
+        }
+
+        if (record->second.entity) {
+            FrameBudgetScope budgetScope(*m_frameBudget, FrameBudgetStage::ChunkUnload);
+            save_chunk_if_dirty(chunkPos, record->second.entity);
+            it.world().entity(record->second.entity).destruct();
         }
+        m_chunks.erase(record);
     }
 }
 
-bool ChunkManager::is_chunk_still_needed(const glm::ivec3& chunkPos, flecs::iter &it) {
-    bool stillNeeded = false;
-    it.world().each<ChunkLoader>([&](flecs::entity e, ChunkLoader& loader) {
-        if (loader.desiredChunks.contains(chunkPos)) {
-            stillNeeded = true;
+float ChunkManager::loader_priority(const glm::ivec3 &chunkPos, const glm::ivec3 &center, const glm::vec3 &viewDirection,
+                                    const glm::vec3 &travelDirection) {
+    const glm::vec3 delta = glm::vec3(chunkPos - center);
+    const float distance = glm::length(delta);
+    if (distance == 0.0f) return 0.0f;
+
+    // 0 in front of the loader, 1 behind it
+    const glm::vec3 direction = delta / distance;
+    const float behindView = (1.0f - glm::dot(direction, viewDirection)) * 0.5f;
+    const float behindTravel = (1.0f - glm::dot(direction, travelDirection)) * 0.5f;
+    return distance * (1.0f + VIEW_DIRECTION_WEIGHT * behindView + TRAVEL_DIRECTION_WEIGHT * behindTravel);
+}
+
+float ChunkManager::load_priority(const glm::ivec3 &chunkPos) const {
+    float priority = FLT_MAX;
+    for (const LoaderView& view : m_loaderViews) {
+        priority = std::min(priority, loader_priority(chunkPos, view.center, view.viewDirection, view.travelDirection));
+    }
+    return priority;
+}
+
+glm::vec3 ChunkManager::travel_direction(const ChunkLoader &loader) {
+    const float speed = glm::length(loader.velocity);
+    return speed >= PREFETCH_MIN_SPEED ? loader.velocity / speed : glm::vec3(0.0f);
+}
+
+TaskPriority ChunkManager::to_task_priority(float loadPriority) {
+    if (loadPriority <= HIGH_PRIORITY_MAX) return TaskPriority::High;
+    if (loadPriority >= LOW_PRIORITY_MIN) return TaskPriority::Low;
+    return TaskPriority::Normal;
+}
+
+TaskPriority ChunkManager::get_streaming_priority(const glm::ivec3 &chunkPos) const {
+    return to_task_priority(load_priority(chunkPos));
+}
+
+void ChunkManager::save_chunk_if_dirty(const glm::ivec3 &chunkPos, flecs::entity chunkEntity) {
+    const VoxelChunk* chunk = chunkEntity.get<VoxelChunk>();
+    if (!chunk || !chunk->dirty) return;
+
+    if (!m_regionStore->save(chunkPos, *chunk->voxels)) {
+        LOG_ERROR("ChunkManager", "Failed to save chunk ({}, {}, {})", chunkPos.x, chunkPos.y, chunkPos.z);
+    }
+}
+
+void ChunkManager::shutdown() {
+    if (m_generationPool) {
+        m_generationPool->shutdown();
+    }
+
+    if (m_regionStore) {
+        for (auto& [chunkPos, record] : m_chunks) {
+            if (record.entity && record.entity.is_alive()) {
+                save_chunk_if_dirty(chunkPos, record.entity);
+            }
         }
-    });
-    return stillNeeded;
+        m_regionStore->close_all();
+    }
 }
 
 void ChunkManager::Register(flecs::world &ecs) {
     ecs.component<ChunkLoader>();
 
-    ecs.set<ChunkManager>({});
+    ecs.emplace<ChunkManager>();
     ecs.get_mut<ChunkManager>()->init(ecs);
 }
\ No newline at end of file
@@ -1,10 +1,35 @@
 #pragma once
 #include <deque>
-#include <unordered_set>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include <flecs.h>
 
+#include "ChunkGenerationPool.h"
+#include "RegionFileStore.h"
 #include "world_components.h"
 #include "core/main_components.h"
+#include "core/task/CancellationToken.h"
+#include "core/task/FrameBudget.h"
+#include "core/task/TaskScheduler.h"
+
+// Lifecycle of a chunk in the ChunkManager. Once generated, the meshing and upload of the chunk entity are tracked
+// by the renderer with the VoxelChunkMeshState relation (Dirty -> Meshing -> ReadyForUpload -> Uploading -> Clean).
+enum class ChunkState : uint8_t {
+    Queued,     // in the load queue
+    Generating, // submitted to the generation workers
+    Generated,  // loaded, with an entity if it has voxels
+    Unloading,  // in the unload queue, back to Generated if a loader needs it again before it is unloaded
+};
+
+struct ChunkRecord {
+    ChunkState state = ChunkState::Queued;
+    // Given when the chunk is queued. A load request or a generation result of another generation is stale
+    uint32_t generation = 0;
+    // Cancels the generation task when the last loader releases the chunk before it is generated
+    CancellationToken cancellation;
+    flecs::entity entity; // null for a chunk full of air
+};
 
 /**
  * Class with the responsibility to manage chunk loading, unloading, and overall chunk lifecycle.
@@ -17,25 +42,113 @@ public:
     void init(flecs::world& ecs);
     void static Register(flecs::world& ecs);
 
+    /**
+     * Stop the chunk generation and write the modified chunks back to the region store.
+     * Chunks still being generated are dropped. The TaskScheduler must be shut down first, its workers may be
+     * accessing the region store.
+     */
+    void shutdown();
+
+    /**
+     * Entity of a loaded chunk holding voxels
+     * @param chunkPos Chunk coordinate
+     * @return The chunk entity, or a null entity if the chunk is not loaded or is empty
+     */
+    flecs::entity find_chunk(const glm::ivec3& chunkPos) const {
+        auto it = m_chunks.find(chunkPos);
+        return it != m_chunks.end() && is_generated(it->second) ? it->second.entity : flecs::entity();
+    }
+
+    /**
+     * Whether the chunk is known to be full of air (it has no entity)
+     */
+    bool is_chunk_empty(const glm::ivec3& chunkPos) const {
+        auto it = m_chunks.find(chunkPos);
+        return it != m_chunks.end() && is_generated(it->second) && !it->second.entity;
+    }
+
+    /**
+     * Scheduler priority for the work of a chunk (generation, meshing): High near the loaders and in their direction
+     * of travel, Low far behind them
+     */
+    TaskPriority get_streaming_priority(const glm::ivec3& chunkPos) const;
+
+    // Stats
+    size_t get_chunk_count() const { return m_chunks.size(); } // from queued to unloading
+    size_t get_load_queue_size() const { return m_loadQueue.size(); }
+    uint64_t get_generated_count() const { return m_generatedCount; } // chunks generated since the start
+    uint64_t get_loaded_count() const { return m_loadedCount; }       // chunks read from the region store since the start
+
 private:
-    std::deque<glm::ivec3> m_loadQueue;
-    std::deque<glm::ivec3> m_unloadQueue;
+    std::unique_ptr<RegionFileStore> m_regionStore;
+    std::unique_ptr<ChunkGenerationPool> m_generationPool;
+    FrameBudget* m_frameBudget = nullptr; // chunk creations and unloads are throttled by the frame time
+
+    // Chunk waiting for a generation slot, the lowest priority is generated first
+    struct LoadRequest {
+        glm::ivec3 chunkPos;
+        float priority;
+        uint32_t generation; // ChunkRecord::generation when queued
 
-    std::unordered_map<glm::ivec3, flecs::entity, IVec3Hash> m_loadedChunks;
-    std::unordered_set<glm::ivec3, IVec3Hash> m_emptyChunks;
-    std::unordered_set<glm::ivec3, IVec3Hash> m_loadingChunks;
+        bool operator>(const LoadRequest& other) const { return priority > other.priority; }
+    };
 
-    static constexpr int MAX_CHUNKS_PER_FRAME = 10;
-    static constexpr int MAX_UNLOADS_PER_FRAME = 50;
+    // Center and view direction of a loader, cached each frame to reorder the load queue
+    struct LoaderView {
+        glm::ivec3 center;
+        glm::vec3 viewDirection;
+        glm::vec3 travelDirection;
+    };
+
+    // Min-heap on LoadRequest::priority (std::push_heap/std::pop_heap with std::greater)
+    std::vector<LoadRequest> m_loadQueue;
+    std::deque<glm::ivec3> m_unloadQueue; // chunks in the Unloading state
+    std::vector<LoaderView> m_loaderViews;
+
+    // Every chunk from the moment it is queued to its unload
+    std::unordered_map<glm::ivec3, ChunkRecord, IVec3Hash> m_chunks;
+    uint32_t m_nextGeneration = 0;
+    uint64_t m_generatedCount = 0;
+    uint64_t m_loadedCount = 0;
+    // Number of loaders whose load sphere contains the chunk, a chunk without entry is not needed anymore
+    std::unordered_map<glm::ivec3, uint32_t, IVec3Hash> m_chunkRefs;
+
+    // Generation submitted to the workers at once. Keep the rest in m_loadQueue so it can still be reordered/dropped
+    static constexpr size_t MAX_GENERATIONS_IN_FLIGHT = 256;
+    // A chunk straight behind a loader is prioritized as if it was (1 + VIEW_DIRECTION_WEIGHT) times farther,
+    // and (1 + TRAVEL_DIRECTION_WEIGHT) times farther if it is behind the direction the loader moves to
+    static constexpr float VIEW_DIRECTION_WEIGHT = 1.0f;
+    static constexpr float TRAVEL_DIRECTION_WEIGHT = 2.0f;
+    // Load priorities under HIGH_PRIORITY_MAX are generated and meshed first, above LOW_PRIORITY_MIN last
+    static constexpr float HIGH_PRIORITY_MAX = 4.0f;
+    static constexpr float LOW_PRIORITY_MIN = 16.0f;
+
+    // Prefetch while the loader moves faster than PREFETCH_MIN_SPEED (world units per second): a sphere of a third
+    // of the load radius, where the loader will be in PREFETCH_LOOKAHEAD_SECONDS (at most at the load radius)
+    static constexpr float PREFETCH_MIN_SPEED = 4.0f;
+    static constexpr float PREFETCH_LOOKAHEAD_SECONDS = 2.0f;
+    // Weight of the last frame in the smoothed loader velocity
+    static constexpr float VELOCITY_SMOOTHING = 0.2f;
+    static constexpr const char* REGION_DIRECTORY = "world/regions";
 
     // Ecs systems
     void update_desired_chunk_system(flecs::entity e, ChunkLoader& loader, const Position& position);
     void process_load_queue_system(flecs::iter& it);
     void process_unload_queue_system(flecs::iter& it);
 
+    void update_load_spheres(ChunkLoader& loader, const glm::ivec3& centerChunkPos);
+    void update_prefetch_sphere(ChunkLoader& loader, const glm::vec3& position);
+
     // Action methods
-    void load_chunks_at_radius(const ChunkCoordinate& center, int radius);
+    void queue_load(const glm::ivec3& chunkPos, float priority);
+    void queue_unload(const glm::ivec3& chunkPos);
+    void retain_chunk(const glm::ivec3& chunkPos);
+    void release_chunk(const glm::ivec3& chunkPos);
 
+    /**
+     * Drop the references of a removed loader, the chunks of its unload sphere are queued for unload
+     */
+    void release_loader(const ChunkLoader& loader);
 
     // Helper
     static glm::ivec3 world_pos_to_chunk_pos(const glm::vec3& worldPos) {
@@ -46,8 +159,8 @@ private:
         };
     }
 
-    bool is_chunk_processed(const glm::ivec3& pos) const {
-        return m_loadedChunks.contains(pos) || m_emptyChunks.contains(pos);
+    static bool is_generated(const ChunkRecord& record) {
+        return record.state == ChunkState::Generated || record.state == ChunkState::Unloading;
     }
 
     static bool is_within_sphere(const glm::ivec3& center, const glm::ivec3& point, int radius) {
@@ -55,5 +168,24 @@ private:
         return diff.x * diff.x + diff.y * diff.y + diff.z * diff.z <= radius * radius;
     }
 
-    static bool is_chunk_still_needed(const glm::ivec3& chunkPos, flecs::iter &it);
+    /**
+     * Load priority of a chunk for one loader: its distance in chunks, weighted by how far it is from the view and
+     * travel directions
+     */
+    static float loader_priority(const glm::ivec3& chunkPos, const glm::ivec3& center, const glm::vec3& viewDirection,
+                                 const glm::vec3& travelDirection);
+
+    static glm::vec3 travel_direction(const ChunkLoader& loader);
+    static TaskPriority to_task_priority(float loadPriority);
+
+    /**
+     * Lowest loader_priority of the chunk over the loaders of the current frame
+     */
+    float load_priority(const glm::ivec3& chunkPos) const;
+
+    bool is_chunk_still_needed(const glm::ivec3& chunkPos) const {
+        return m_chunkRefs.contains(chunkPos);
+    }
+
+    void save_chunk_if_dirty(const glm::ivec3& chunkPos, flecs::entity chunkEntity);
 };
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "PalettedVoxelStorage.h"
+
+#include <array>
+#include <cstring>
+
+PalettedVoxelStorage::PalettedVoxelStorage(uint32_t volume, uint8_t fillValue)
+    : m_volume(volume), m_uniformValue(fillValue) {}
+
+uint8_t PalettedVoxelStorage::bits_for_palette_size(size_t paletteSize) {
+    if (paletteSize <= 1) return 0;
+    if (paletteSize <= 2) return 1;
+    if (paletteSize <= 4) return 2;
+    if (paletteSize <= 16) return 4;
+    return 8;
+}
+
+void PalettedVoxelStorage::set(uint32_t index, uint8_t value) {
+    if (m_bitsPerIndex == 0) {
+        if (value == m_uniformValue) return;
+
+        // promote: every voxel points to the old value (index 0), except the one being set
+        m_palette = {m_uniformValue, value};
+        m_paletteCount = {m_volume - 1, 1};
+        m_usedPaletteEntries = 2;
+        m_bitsPerIndex = 1;
+        m_data.assign((static_cast<size_t>(m_volume) + 63) / 64, 0);
+        write_index(index, 1);
+        return;
+    }
+
+    const uint32_t oldPaletteIndex = read_index(index);
+    if (m_palette[oldPaletteIndex] == value) return;
+
+    const uint32_t newPaletteIndex = find_or_add_palette_entry(value);
+    write_index(index, newPaletteIndex);
+    m_paletteCount[newPaletteIndex]++;
+
+    if (--m_paletteCount[oldPaletteIndex] == 0) {
+        m_usedPaletteEntries--;
+
+        // demote: the value we just wrote is the only one left in the chunk
+        if (m_usedPaletteEntries == 1) {
+            fill(value);
+        }
+    }
+}
+
+uint32_t PalettedVoxelStorage::find_or_add_palette_entry(uint8_t value) {
+    uint32_t freeEntry = UINT32_MAX;
+    for (uint32_t i = 0; i < m_palette.size(); i++) {
+        if (m_palette[i] == value) {
+            if (m_paletteCount[i] == 0) m_usedPaletteEntries++;
+            return i;
+        }
+        if (m_paletteCount[i] == 0 && freeEntry == UINT32_MAX) {
+            freeEntry = i;
+        }
+    }
+
+    // Reuse a palette entry that isn't referenced anymore
+    if (freeEntry != UINT32_MAX) {
+        m_palette[freeEntry] = value;
+        m_usedPaletteEntries++;
+        return freeEntry;
+    }
+
+    m_palette.push_back(value);
+    m_paletteCount.push_back(0);
+    m_usedPaletteEntries++;
+
+    if (m_palette.size() > (size_t{1} << m_bitsPerIndex)) {
+        repack(bits_for_palette_size(m_palette.size()));
+    }
+    return static_cast<uint32_t>(m_palette.size() - 1);
+}
+
+void PalettedVoxelStorage::repack(uint8_t newBitsPerIndex) {
+    std::vector<uint64_t> oldData = std::move(m_data);
+    const uint8_t oldBitsPerIndex = m_bitsPerIndex;
+
+    m_bitsPerIndex = newBitsPerIndex;
+    m_data.assign((static_cast<size_t>(m_volume) * newBitsPerIndex + 63) / 64, 0);
+
+    const uint64_t oldMask = (uint64_t{1} << oldBitsPerIndex) - 1;
+    for (uint32_t i = 0; i < m_volume; i++) {
+        const uint32_t bitPos = i * oldBitsPerIndex;
+        write_index(i, static_cast<uint32_t>((oldData[bitPos >> 6] >> (bitPos & 63)) & oldMask));
+    }
+}
+
+void PalettedVoxelStorage::fill(uint8_t value) {
+    m_bitsPerIndex = 0;
+    m_uniformValue = value;
+    m_usedPaletteEntries = 0;
+
+    // release the memory, a uniform chunk only keeps its value
+    std::vector<uint8_t>().swap(m_palette);
+    std::vector<uint32_t>().swap(m_paletteCount);
+    std::vector<uint64_t>().swap(m_data);
+}
+
+void PalettedVoxelStorage::assign(const uint8_t *dense) {
+    std::array<uint32_t, 256> histogram = {};
+    for (uint32_t i = 0; i < m_volume; i++) {
+        histogram[dense[i]]++;
+    }
+
+    std::array<uint8_t, 256> valueToPaletteIndex = {};
+    std::vector<uint8_t> palette;
+    std::vector<uint32_t> paletteCount;
+    for (uint32_t value = 0; value < 256; value++) {
+        if (histogram[value] == 0) continue;
+        valueToPaletteIndex[value] = static_cast<uint8_t>(palette.size());
+        palette.push_back(static_cast<uint8_t>(value));
+        paletteCount.push_back(histogram[value]);
+    }
+
+    if (palette.size() <= 1) {
+        fill(m_volume > 0 ? dense[0] : 0);
+        return;
+    }
+
+    m_palette = std::move(palette);
+    m_paletteCount = std::move(paletteCount);
+    m_usedPaletteEntries = static_cast<uint32_t>(m_palette.size());
+    m_bitsPerIndex = bits_for_palette_size(m_palette.size());
+    m_data.assign((static_cast<size_t>(m_volume) * m_bitsPerIndex + 63) / 64, 0);
+
+    // indices never straddle two words, so each word can be built in a register
+    const uint32_t indicesPerWord = 64 / m_bitsPerIndex;
+    for (size_t word = 0; word < m_data.size(); word++) {
+        uint64_t packed = 0;
+        const uint32_t first = static_cast<uint32_t>(word * indicesPerWord);
+        for (uint32_t j = 0; j < indicesPerWord && first + j < m_volume; j++) {
+            packed |= static_cast<uint64_t>(valueToPaletteIndex[dense[first + j]]) << (j * m_bitsPerIndex);
+        }
+        m_data[word] = packed;
+    }
+}
+
+void PalettedVoxelStorage::unpack(uint8_t *dense) const {
+    if (m_bitsPerIndex == 0) {
+        std::memset(dense, m_uniformValue, m_volume);
+        return;
+    }
+
+    const uint32_t indicesPerWord = 64 / m_bitsPerIndex;
+    const uint64_t mask = (uint64_t{1} << m_bitsPerIndex) - 1;
+    for (size_t word = 0; word < m_data.size(); word++) {
+        uint64_t packed = m_data[word];
+        const uint32_t first = static_cast<uint32_t>(word * indicesPerWord);
+        for (uint32_t j = 0; j < indicesPerWord && first + j < m_volume; j++) {
+            dense[first + j] = m_palette[packed & mask];
+            packed >>= m_bitsPerIndex;
+        }
+    }
+}
+
+void PalettedVoxelStorage::compact() {
+    if (m_bitsPerIndex == 0) return;
+
+    std::array<uint8_t, 256> remap = {};
+    std::vector<uint8_t> palette;
+    std::vector<uint32_t> paletteCount;
+    for (uint32_t i = 0; i < m_palette.size(); i++) {
+        if (m_paletteCount[i] == 0) continue;
+        remap[i] = static_cast<uint8_t>(palette.size());
+        palette.push_back(m_palette[i]);
+        paletteCount.push_back(m_paletteCount[i]);
+    }
+
+    if (palette.size() == 1) {
+        fill(palette[0]);
+        return;
+    }
+
+    const uint8_t newBitsPerIndex = bits_for_palette_size(palette.size());
+    if (palette.size() == m_palette.size() && newBitsPerIndex == m_bitsPerIndex) return;
+
+    std::vector<uint64_t> oldData = std::move(m_data);
+    const uint8_t oldBitsPerIndex = m_bitsPerIndex;
+    const uint64_t oldMask = (uint64_t{1} << oldBitsPerIndex) - 1;
+
+    m_palette = std::move(palette);
+    m_paletteCount = std::move(paletteCount);
+    m_usedPaletteEntries = static_cast<uint32_t>(m_palette.size());
+    m_bitsPerIndex = newBitsPerIndex;
+    m_data.assign((static_cast<size_t>(m_volume) * newBitsPerIndex + 63) / 64, 0);
+
+    for (uint32_t i = 0; i < m_volume; i++) {
+        const uint32_t bitPos = i * oldBitsPerIndex;
+        write_index(i, remap[(oldData[bitPos >> 6] >> (bitPos & 63)) & oldMask]);
+    }
+}
+
+bool PalettedVoxelStorage::restore(uint8_t bitsPerIndex, uint8_t uniformValue,
+                                   std::vector<uint8_t> palette, std::vector<uint64_t> data) {
+    if (bitsPerIndex == 0) {
+        fill(uniformValue);
+        return true;
+    }
+
+    if (bitsPerIndex != 1 && bitsPerIndex != 2 && bitsPerIndex != 4 && bitsPerIndex != 8) return false;
+    if (palette.empty() || palette.size() > (size_t{1} << bitsPerIndex)) return false;
+    if (data.size() != (static_cast<size_t>(m_volume) * bitsPerIndex + 63) / 64) return false;
+
+    // rebuild the reference counts from the indices
+    std::vector<uint32_t> paletteCount(palette.size(), 0);
+    const uint64_t mask = (uint64_t{1} << bitsPerIndex) - 1;
+    for (uint32_t i = 0; i < m_volume; i++) {
+        const uint32_t bitPos = i * bitsPerIndex;
+        const uint64_t paletteIndex = (data[bitPos >> 6] >> (bitPos & 63)) & mask;
+        if (paletteIndex >= palette.size()) return false;
+        paletteCount[paletteIndex]++;
+    }
+
+    m_bitsPerIndex = bitsPerIndex;
+    m_palette = std::move(palette);
+    m_paletteCount = std::move(paletteCount);
+    m_data = std::move(data);
+    m_usedPaletteEntries = 0;
+    for (uint32_t count : m_paletteCount) {
+        if (count > 0) m_usedPaletteEntries++;
+    }
+
+    compact();
+    return true;
+}
+
+size_t PalettedVoxelStorage::memory_usage() const {
+    return sizeof(PalettedVoxelStorage)
+         + m_palette.capacity() * sizeof(uint8_t)
+         + m_paletteCount.capacity() * sizeof(uint32_t)
+         + m_data.capacity() * sizeof(uint64_t);
+}
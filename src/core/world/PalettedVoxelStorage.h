@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Paletted storage for the voxels of a chunk.
+ * A homogeneous chunk (full air, full stone...) only stores its single value. Otherwise each voxel stores an
+ * index into a per-chunk palette, bit-packed with the smallest width able to address the palette (1, 2, 4 or 8 bits).
+ * The storage promotes to a wider index when a new value doesn't fit in the palette, and demotes back to a single
+ * value when only one palette entry is still in use.
+ */
+class PalettedVoxelStorage {
+public:
+    explicit PalettedVoxelStorage(uint32_t volume, uint8_t fillValue = 0);
+
+    uint8_t get(uint32_t index) const {
+        if (m_bitsPerIndex == 0) return m_uniformValue;
+        return m_palette[read_index(index)];
+    }
+
+    void set(uint32_t index, uint8_t value);
+
+    /**
+     * Reset the storage to a single value
+     */
+    void fill(uint8_t value);
+
+    /**
+     * Replace the whole content with a dense voxel array of `volume` values. The palette is rebuilt in one pass,
+     * which is a lot cheaper than calling set() for every voxel.
+     */
+    void assign(const uint8_t* dense);
+
+    /**
+     * Decode the whole content in a dense voxel array of `volume` values
+     */
+    void unpack(uint8_t* dense) const;
+
+    /**
+     * Drop unused palette entries and shrink the index width if possible
+     */
+    void compact();
+
+    bool is_uniform() const { return m_bitsPerIndex == 0; }
+    uint8_t get_uniform_value() const { return m_uniformValue; }
+
+    uint32_t get_volume() const { return m_volume; }
+    uint8_t get_bits_per_index() const { return m_bitsPerIndex; }
+    const std::vector<uint8_t>& get_palette() const { return m_palette; }
+    const std::vector<uint64_t>& get_packed_data() const { return m_data; }
+
+    /**
+     * Restore a storage previously read with get_palette() / get_packed_data() / get_bits_per_index().
+     * @return False if the data is not consistent (wrong size or palette index out of range)
+     */
+    bool restore(uint8_t bitsPerIndex, uint8_t uniformValue, std::vector<uint8_t> palette, std::vector<uint64_t> data);
+
+    /**
+     * Heap + inline memory used by this storage, in bytes
+     */
+    size_t memory_usage() const;
+
+private:
+    uint32_t m_volume;
+
+    uint8_t m_bitsPerIndex = 0; // 0 = uniform, otherwise 1, 2, 4 or 8
+    uint8_t m_uniformValue = 0;
+
+    std::vector<uint8_t> m_palette;       // palette index -> voxel value
+    std::vector<uint32_t> m_paletteCount; // palette index -> number of voxels using it (0 = free entry)
+    uint32_t m_usedPaletteEntries = 0;
+
+    std::vector<uint64_t> m_data; // bit-packed palette indices, never straddling two words
+
+    uint32_t read_index(uint32_t index) const {
+        const uint32_t bitPos = index * m_bitsPerIndex;
+        const uint64_t mask = (uint64_t{1} << m_bitsPerIndex) - 1;
+        return static_cast<uint32_t>((m_data[bitPos >> 6] >> (bitPos & 63)) & mask);
+    }
+
+    void write_index(uint32_t index, uint32_t paletteIndex) {
+        const uint32_t bitPos = index * m_bitsPerIndex;
+        const uint64_t mask = (uint64_t{1} << m_bitsPerIndex) - 1;
+        uint64_t& word = m_data[bitPos >> 6];
+        word = (word & ~(mask << (bitPos & 63))) | (static_cast<uint64_t>(paletteIndex) << (bitPos & 63));
+    }
+
+    static uint8_t bits_for_palette_size(size_t paletteSize);
+
+    /**
+     * Re-pack every index with a new width. The palette itself is kept as is.
+     */
+    void repack(uint8_t newBitsPerIndex);
+
+    uint32_t find_or_add_palette_entry(uint8_t value);
+};
@@ -0,0 +1,380 @@
+#include "RegionFileStore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <shared_mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/log/Logger.h"
+
+namespace {
+    constexpr char REGION_MAGIC[4] = {'V', 'P', 'R', 'G'};
+    constexpr uint32_t REGION_VERSION = 1;
+
+    struct RegionHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t dataEnd; // end of the last record, the file itself can be bigger (preallocated)
+    };
+
+    struct RegionEntry {
+        uint32_t offset; // byte offset of the record in the file
+        uint32_t size;   // byte size of the record, 0 = no record
+    };
+
+    // An entry without record but with this offset is a chunk known to be full of air
+    constexpr uint32_t EMPTY_CHUNK_OFFSET = UINT32_MAX;
+
+    constexpr uint64_t ENTRIES_OFFSET = sizeof(RegionHeader);
+    constexpr uint64_t DATA_OFFSET = ENTRIES_OFFSET + sizeof(RegionEntry) * RegionFileStore::CHUNKS_PER_REGION;
+
+    constexpr uint64_t FILE_GROWTH_STEP = 1024 * 1024; // 1 MB
+    constexpr uint64_t COMPACT_MIN_DEAD_BYTES = 4 * 1024 * 1024; // 4 MB
+
+    /*
+     * Record layout:
+     *   uint8  bitsPerIndex (0 = uniform)
+     *   uint8  uniformValue
+     *   uint16 paletteSize
+     *   uint8  palette[paletteSize], padded to 8 bytes
+     *   uint64 data[]
+     */
+    constexpr size_t RECORD_HEADER_SIZE = 4;
+
+    size_t align8(size_t value) { return (value + 7) & ~size_t{7}; }
+
+    std::vector<uint8_t> serialize_storage(const PalettedVoxelStorage& storage) {
+        const auto& palette = storage.get_palette();
+        const auto& data = storage.get_packed_data();
+        const size_t paletteSize = storage.is_uniform() ? 0 : palette.size();
+        const size_t dataOffset = align8(RECORD_HEADER_SIZE + paletteSize);
+
+        std::vector<uint8_t> record(dataOffset + (storage.is_uniform() ? 0 : data.size() * sizeof(uint64_t)), 0);
+        record[0] = storage.get_bits_per_index();
+        record[1] = storage.get_uniform_value();
+        const uint16_t paletteSize16 = static_cast<uint16_t>(paletteSize);
+        std::memcpy(&record[2], &paletteSize16, sizeof(uint16_t));
+        if (paletteSize > 0) {
+            std::memcpy(&record[RECORD_HEADER_SIZE], palette.data(), paletteSize);
+            std::memcpy(&record[dataOffset], data.data(), data.size() * sizeof(uint64_t));
+        }
+        return record;
+    }
+
+    bool deserialize_storage(const uint8_t* record, size_t size, PalettedVoxelStorage& outStorage) {
+        if (size < RECORD_HEADER_SIZE) return false;
+
+        const uint8_t bitsPerIndex = record[0];
+        const uint8_t uniformValue = record[1];
+        uint16_t paletteSize;
+        std::memcpy(&paletteSize, &record[2], sizeof(uint16_t));
+
+        const size_t dataOffset = align8(RECORD_HEADER_SIZE + paletteSize);
+        if (dataOffset > size) return false;
+
+        std::vector<uint8_t> palette(record + RECORD_HEADER_SIZE, record + RECORD_HEADER_SIZE + paletteSize);
+        std::vector<uint64_t> data((size - dataOffset) / sizeof(uint64_t));
+        std::memcpy(data.data(), record + dataOffset, data.size() * sizeof(uint64_t));
+
+        return outStorage.restore(bitsPerIndex, uniformValue, std::move(palette), std::move(data));
+    }
+}
+
+class RegionFileStore::RegionFile {
+public:
+    ~RegionFile() { close(); }
+
+    static std::unique_ptr<RegionFile> open(const std::filesystem::path& path, bool create) {
+        auto region = std::unique_ptr<RegionFile>(new RegionFile(path));
+
+        region->m_fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+        if (region->m_fd < 0) {
+            if (create) {
+                LOG_ERROR("RegionFileStore", "Failed to open region file {}: {}", path.string(), strerror(errno));
+            }
+            return nullptr;
+        }
+
+        if (!region->read_header()) {
+            if (!create) return nullptr;
+
+            struct stat st{};
+            if (fstat(region->m_fd, &st) == 0 && st.st_size > 0) {
+                LOG_WARN("RegionFileStore", "Invalid region file {}, starting a new one", path.string());
+            }
+            if (!region->write_new_header()) return nullptr;
+        }
+
+        return region;
+    }
+
+    RegionLoadResult read(uint32_t localIndex, PalettedVoxelStorage& outStorage) {
+        std::shared_lock lock(m_mutex);
+
+        const RegionEntry entry = m_entries[localIndex];
+        if (entry.size == 0) {
+            return entry.offset == EMPTY_CHUNK_OFFSET ? RegionLoadResult::Empty : RegionLoadResult::Missing;
+        }
+
+        if (entry.offset + static_cast<uint64_t>(entry.size) > m_dataEnd ||
+            !deserialize_storage(m_mapping + entry.offset, entry.size, outStorage)) {
+            LOG_ERROR("RegionFileStore", "Corrupted chunk record {} in {}", localIndex, m_path.string());
+            return RegionLoadResult::Missing;
+        }
+        return RegionLoadResult::Loaded;
+    }
+
+    /**
+     * @param record Serialized chunk, or an empty record for a chunk full of air
+     */
+    bool write(uint32_t localIndex, const std::vector<uint8_t>& record) {
+        std::unique_lock lock(m_mutex);
+
+        RegionEntry& entry = m_entries[localIndex];
+        RegionEntry newEntry = {EMPTY_CHUNK_OFFSET, 0};
+
+        if (!record.empty()) {
+            if (!ensure_capacity(m_dataEnd + record.size())) return false;
+            if (pwrite(m_fd, record.data(), record.size(), static_cast<off_t>(m_dataEnd)) != static_cast<ssize_t>(record.size())) {
+                LOG_ERROR("RegionFileStore", "Failed to write chunk record in {}: {}", m_path.string(), strerror(errno));
+                return false;
+            }
+            newEntry = {static_cast<uint32_t>(m_dataEnd), static_cast<uint32_t>(record.size())};
+            m_dataEnd += record.size();
+            m_liveBytes += record.size();
+        }
+
+        m_liveBytes -= entry.size;
+        entry = newEntry;
+
+        if (!write_entry(localIndex) || !write_data_end()) return false;
+
+        const uint64_t deadBytes = m_dataEnd - DATA_OFFSET - m_liveBytes;
+        if (deadBytes > COMPACT_MIN_DEAD_BYTES && deadBytes > m_liveBytes) {
+            compact();
+        }
+        return true;
+    }
+
+private:
+    explicit RegionFile(std::filesystem::path path) : m_path(std::move(path)) {
+        m_entries.resize(CHUNKS_PER_REGION, RegionEntry{0, 0});
+    }
+
+    std::filesystem::path m_path;
+    int m_fd = -1;
+
+    uint8_t* m_mapping = nullptr;
+    size_t m_mappedSize = 0;
+
+    uint64_t m_dataEnd = DATA_OFFSET;
+    uint64_t m_liveBytes = 0;
+    std::vector<RegionEntry> m_entries;
+
+    std::shared_mutex m_mutex;
+
+    void close() {
+        unmap();
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    void unmap() {
+        if (m_mapping) {
+            munmap(m_mapping, m_mappedSize);
+            m_mapping = nullptr;
+            m_mappedSize = 0;
+        }
+    }
+
+    bool map(size_t size) {
+        unmap();
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (mapping == MAP_FAILED) {
+            LOG_ERROR("RegionFileStore", "Failed to map region file {}: {}", m_path.string(), strerror(errno));
+            return false;
+        }
+        m_mapping = static_cast<uint8_t*>(mapping);
+        m_mappedSize = size;
+        return true;
+    }
+
+    bool read_header() {
+        struct stat st{};
+        if (fstat(m_fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < DATA_OFFSET) return false;
+
+        RegionHeader header{};
+        if (pread(m_fd, &header, sizeof(header), 0) != sizeof(header)) return false;
+        if (std::memcmp(header.magic, REGION_MAGIC, sizeof(REGION_MAGIC)) != 0 || header.version != REGION_VERSION) return false;
+        if (header.dataEnd < DATA_OFFSET || header.dataEnd > static_cast<uint64_t>(st.st_size)) return false;
+
+        const size_t entriesSize = sizeof(RegionEntry) * m_entries.size();
+        if (pread(m_fd, m_entries.data(), entriesSize, ENTRIES_OFFSET) != static_cast<ssize_t>(entriesSize)) return false;
+
+        m_dataEnd = header.dataEnd;
+        m_liveBytes = 0;
+        for (const auto& entry : m_entries) {
+            m_liveBytes += entry.size;
+        }
+
+        return map(st.st_size);
+    }
+
+    bool write_new_header() {
+        if (ftruncate(m_fd, 0) != 0) return false;
+
+        std::fill(m_entries.begin(), m_entries.end(), RegionEntry{0, 0});
+        m_dataEnd = DATA_OFFSET;
+        m_liveBytes = 0;
+
+        RegionHeader header{};
+        std::memcpy(header.magic, REGION_MAGIC, sizeof(REGION_MAGIC));
+        header.version = REGION_VERSION;
+        header.dataEnd = m_dataEnd;
+
+        unmap();
+        if (!ensure_capacity(DATA_OFFSET)) return false;
+        if (pwrite(m_fd, &header, sizeof(header), 0) != sizeof(header)) return false;
+        const size_t entriesSize = sizeof(RegionEntry) * m_entries.size();
+        return pwrite(m_fd, m_entries.data(), entriesSize, ENTRIES_OFFSET) == static_cast<ssize_t>(entriesSize);
+    }
+
+    /**
+     * Grow the file (and its mapping) by steps, so appending a record doesn't remap the file every time
+     */
+    bool ensure_capacity(uint64_t requiredSize) {
+        if (requiredSize <= m_mappedSize) return true;
+
+        uint64_t newSize = std::max<uint64_t>(requiredSize, m_mappedSize + m_mappedSize / 2);
+        newSize = (newSize + FILE_GROWTH_STEP - 1) / FILE_GROWTH_STEP * FILE_GROWTH_STEP;
+
+        if (ftruncate(m_fd, static_cast<off_t>(newSize)) != 0) {
+            LOG_ERROR("RegionFileStore", "Failed to grow region file {}: {}", m_path.string(), strerror(errno));
+            return false;
+        }
+        return map(newSize);
+    }
+
+    bool write_entry(uint32_t localIndex) {
+        const uint64_t offset = ENTRIES_OFFSET + sizeof(RegionEntry) * localIndex;
+        return pwrite(m_fd, &m_entries[localIndex], sizeof(RegionEntry), static_cast<off_t>(offset)) == sizeof(RegionEntry);
+    }
+
+    bool write_data_end() {
+        return pwrite(m_fd, &m_dataEnd, sizeof(m_dataEnd), offsetof(RegionHeader, dataEnd)) == sizeof(m_dataEnd);
+    }
+
+    /**
+     * Rewrite the file with only the live records, then swap it with the current one.
+     * Called with the write lock held.
+     */
+    void compact() {
+        const std::filesystem::path tmpPath = m_path.string() + ".tmp";
+        int tmpFd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (tmpFd < 0) {
+            LOG_ERROR("RegionFileStore", "Failed to compact region file {}: {}", m_path.string(), strerror(errno));
+            return;
+        }
+
+        std::vector<RegionEntry> newEntries = m_entries;
+        uint64_t dataEnd = DATA_OFFSET;
+        bool ok = true;
+        for (auto& entry : newEntries) {
+            if (entry.size == 0) continue;
+            ok &= pwrite(tmpFd, m_mapping + entry.offset, entry.size, static_cast<off_t>(dataEnd)) == static_cast<ssize_t>(entry.size);
+            entry.offset = static_cast<uint32_t>(dataEnd);
+            dataEnd += entry.size;
+        }
+
+        RegionHeader header{};
+        std::memcpy(header.magic, REGION_MAGIC, sizeof(REGION_MAGIC));
+        header.version = REGION_VERSION;
+        header.dataEnd = dataEnd;
+        const size_t entriesSize = sizeof(RegionEntry) * newEntries.size();
+        ok &= pwrite(tmpFd, &header, sizeof(header), 0) == sizeof(header);
+        ok &= pwrite(tmpFd, newEntries.data(), entriesSize, ENTRIES_OFFSET) == static_cast<ssize_t>(entriesSize);
+
+        std::error_code ec;
+        if (ok) std::filesystem::rename(tmpPath, m_path, ec);
+        if (!ok || ec) {
+            LOG_ERROR("RegionFileStore", "Failed to compact region file {}", m_path.string());
+            ::close(tmpFd);
+            std::filesystem::remove(tmpPath, ec);
+            return;
+        }
+
+        LOG_DEBUG("RegionFileStore", "Compacted {} from {} to {} bytes", m_path.string(), m_dataEnd, dataEnd);
+
+        close();
+        m_fd = tmpFd;
+        m_entries = std::move(newEntries);
+        m_dataEnd = dataEnd;
+        m_mappedSize = 0;
+        ensure_capacity(m_dataEnd);
+    }
+};
+
+RegionFileStore::RegionFileStore(std::filesystem::path directory) : m_directory(std::move(directory)) {
+    std::error_code ec;
+    std::filesystem::create_directories(m_directory, ec);
+    if (ec) {
+        LOG_ERROR("RegionFileStore", "Failed to create region directory {}: {}", m_directory.string(), ec.message());
+    }
+}
+
+RegionFileStore::~RegionFileStore() = default;
+
+std::filesystem::path RegionFileStore::region_path(const glm::ivec3 &regionCoord) const {
+    return m_directory / ("r." + std::to_string(regionCoord.x) + "." + std::to_string(regionCoord.y) + "." +
+                          std::to_string(regionCoord.z) + ".vpr");
+}
+
+RegionFileStore::RegionFile* RegionFileStore::get_region(const glm::ivec3 &regionCoord, bool create) {
+    std::lock_guard<std::mutex> lock(m_regionsMutex);
+
+    auto it = m_regions.find(regionCoord);
+    if (it != m_regions.end() && (it->second || !create)) {
+        return it->second.get();
+    }
+
+    auto region = RegionFile::open(region_path(regionCoord), create);
+    RegionFile* regionPtr = region.get();
+    m_regions[regionCoord] = std::move(region);
+    return regionPtr;
+}
+
+RegionLoadResult RegionFileStore::load(const glm::ivec3 &chunkCoord, PalettedVoxelStorage &outStorage) {
+    RegionFile* region = get_region(chunk_to_region(chunkCoord), false);
+    if (!region) return RegionLoadResult::Missing;
+    return region->read(local_index(chunkCoord), outStorage);
+}
+
+bool RegionFileStore::save(const glm::ivec3 &chunkCoord, const PalettedVoxelStorage &storage) {
+    if (storage.is_uniform() && storage.get_uniform_value() == 0) {
+        return save_empty(chunkCoord);
+    }
+
+    RegionFile* region = get_region(chunk_to_region(chunkCoord), true);
+    if (!region) return false;
+    return region->write(local_index(chunkCoord), serialize_storage(storage));
+}
+
+bool RegionFileStore::save_empty(const glm::ivec3 &chunkCoord) {
+    RegionFile* region = get_region(chunk_to_region(chunkCoord), true);
+    if (!region) return false;
+    return region->write(local_index(chunkCoord), {});
+}
+
+void RegionFileStore::close_all() {
+    std::lock_guard<std::mutex> lock(m_regionsMutex);
+    m_regions.clear();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+#include "world_components.h"
+
+enum class RegionLoadResult {
+    Missing, // never stored, the chunk has to be generated
+    Empty,   // stored as a chunk full of air
+    Loaded,
+};
+
+/**
+ * Persistent chunk store. Chunks are grouped in region files of REGION_SIZE^3 chunks, each file starting with an
+ * offset table indexed by the chunk position inside the region.
+ * Reads go through a memory mapping of the region file and can run concurrently from the generation workers.
+ * Writes append the new record at the end of the file and update the offset table, the file is compacted once
+ * the dead records take more space than the live ones.
+ */
+class RegionFileStore {
+public:
+    static constexpr int REGION_SIZE = 16;
+    static constexpr uint32_t CHUNKS_PER_REGION = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+    explicit RegionFileStore(std::filesystem::path directory);
+    ~RegionFileStore();
+
+    RegionFileStore(const RegionFileStore&) = delete;
+    RegionFileStore& operator=(const RegionFileStore&) = delete;
+
+    /**
+     * Read a chunk from the store
+     * @param chunkCoord Chunk coordinate
+     * @param outStorage Storage to fill, only modified if the chunk has been found
+     * @return Whether the chunk was found, and if it is an empty chunk
+     */
+    RegionLoadResult load(const glm::ivec3& chunkCoord, PalettedVoxelStorage& outStorage);
+
+    bool save(const glm::ivec3& chunkCoord, const PalettedVoxelStorage& storage);
+
+    /**
+     * Remember that a chunk is full of air, without storing any voxel data
+     */
+    bool save_empty(const glm::ivec3& chunkCoord);
+
+    /**
+     * Close every opened region file (they will be reopened on the next access)
+     */
+    void close_all();
+
+    static glm::ivec3 chunk_to_region(const glm::ivec3& chunkCoord) {
+        return {
+            floor_div(chunkCoord.x, REGION_SIZE),
+            floor_div(chunkCoord.y, REGION_SIZE),
+            floor_div(chunkCoord.z, REGION_SIZE)
+        };
+    }
+
+private:
+    class RegionFile;
+
+    std::filesystem::path m_directory;
+
+    std::mutex m_regionsMutex;
+    // nullptr = region file doesn't exist on disk (avoid hitting the filesystem for every missing chunk)
+    std::unordered_map<glm::ivec3, std::unique_ptr<RegionFile>, IVec3Hash> m_regions;
+
+    RegionFile* get_region(const glm::ivec3& regionCoord, bool create);
+    std::filesystem::path region_path(const glm::ivec3& regionCoord) const;
+
+    static uint32_t local_index(const glm::ivec3& chunkCoord) {
+        const int x = chunkCoord.x - floor_div(chunkCoord.x, REGION_SIZE) * REGION_SIZE;
+        const int y = chunkCoord.y - floor_div(chunkCoord.y, REGION_SIZE) * REGION_SIZE;
+        const int z = chunkCoord.z - floor_div(chunkCoord.z, REGION_SIZE) * REGION_SIZE;
+        return x + y * REGION_SIZE + z * REGION_SIZE * REGION_SIZE;
+    }
+
+    static int floor_div(int a, int b) {
+        return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+    }
+};
@@ -10,11 +10,16 @@ WorldGenerator::WorldGenerator(const int64_t seed) : m_seed(seed) {
     m_terrainNoise->SetOctaveCount(5);
     m_terrainNoise->SetLacunarity(2.0f);
     m_terrainNoise->SetGain(0.5f);
+
+    m_textureTable = std::make_shared<const VoxelTextureTable>(VoxelTextureTable{
+        {"voxelplanet:textures/grass"_asset, 1},
+        {"voxelplanet:textures/cobblestone"_asset, 2}
+    });
 }
 
 WorldGenerator::~WorldGenerator() = default;
 
-bool WorldGenerator::generate_chunk(VoxelChunk &chunk, glm::ivec3 chunkPosition) {
+bool WorldGenerator::generate_chunk(VoxelChunk &chunk, glm::ivec3 chunkPosition) const {
     constexpr float frequency = 0.01f;
     constexpr int baseHeight = 100;
     constexpr int heightAmplitude = 32;
@@ -32,11 +37,10 @@ bool WorldGenerator::generate_chunk(VoxelChunk &chunk, glm::ivec3 chunkPosition)
         m_seed
     );
 
-    chunk.textureIDs = {
-        {"voxelplanet:textures/grass"_asset, 1},
-        {"voxelplanet:textures/cobblestone"_asset, 2}
-    };
+    chunk.textureIDs = m_textureTable;
 
+    // generate in a dense buffer, then let the chunk storage build its palette in one pass
+    std::array<uint8_t, CHUNK_VOLUME> voxels;
     bool hasContent = false;
 
     for (int x = 0; x < CHUNK_SIZE; x++) {
@@ -47,21 +51,25 @@ bool WorldGenerator::generate_chunk(VoxelChunk &chunk, glm::ivec3 chunkPosition)
             for (int y = 0; y < CHUNK_SIZE; y++) {
                 int worldYPos = worldY + y;
 
+                uint8_t& voxel = voxels[VoxelChunk::index_of(x, y, z)];
                 if (worldYPos < terrainHeight) {
                     if (worldYPos == terrainHeight - 1) {
-                        chunk.at(x, y, z) = 1;
+                        voxel = 1;
                     } else if (worldYPos > terrainHeight - 2) {
-                        chunk.at(x, y, z) = 1;
+                        voxel = 1;
                     } else {
-                        chunk.at(x, y, z) = 2;
+                        voxel = 2;
                     }
                     hasContent = true;
                 } else {
-                    chunk.at(x, y, z) = 0;
+                    voxel = 0;
                 }
             }
         }
     }
 
+    chunk.ensure_unique();
+    chunk.voxels->assign(voxels.data());
+
     return hasContent;
 }
@@ -13,14 +13,19 @@ public:
     /**
      * Generate a voxel chunk content at the given chunk position based in the world generator parameters.
      * If there is no data to generate (only air), return false.
+     * Thread-safe: it only reads the generator parameters, so it can be called from the generation workers.
      * @param chunk The chunk to fill
      * @param chunkPosition The position of the chunk in chunk coordinates
      * @return True if the chunk has been filled with data, false if it is empty (all air)
      */
-    bool generate_chunk(VoxelChunk& chunk, glm::ivec3 chunkPosition);
+    bool generate_chunk(VoxelChunk& chunk, glm::ivec3 chunkPosition) const;
+
+    const std::shared_ptr<const VoxelTextureTable>& get_texture_table() const { return m_textureTable; }
 
 private:
     int64_t m_seed;
 
+    std::shared_ptr<const VoxelTextureTable> m_textureTable; // shared by every generated chunk
+
     FastNoise::SmartNode<FastNoise::FractalFBm> m_terrainNoise; // determine terrain height
 };
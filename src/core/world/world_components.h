@@ -6,6 +6,7 @@
 #include <vector>
 #include <array>
 
+#include "PalettedVoxelStorage.h"
 #include "core/resource/asset_id.h"
 
 #define CHUNK_SIZE 32
@@ -25,12 +26,27 @@ struct ChunkCoordinate : glm::ivec3 {
     ChunkCoordinate(const glm::ivec3& v) : glm::ivec3(v) {}
 };
 
+// Keeps the chunks of its load sphere loaded. Each chunk counts the loaders whose load sphere (at lastVisitedChunk
+// with lastLoadRadius) contains it, in the ChunkManager.
 struct ChunkLoader {
     glm::ivec3 lastVisitedChunk = glm::ivec3(INT32_MAX);
-    std::unordered_set<glm::ivec3, IVec3Hash> desiredChunks; // Set of chunk coordinates that should be loaded
     int loadRadius = 4;
     int unloadRadius = 6; // > loadRadius to avoid load/unload thrashing at boundaries
 
+    // Radii of the spheres around lastVisitedChunk, only the difference with the new spheres is walked on a change
+    int lastLoadRadius = 0;
+    int lastUnloadRadius = 0;
+    // Unit view direction of the loader (zero if it has none), the chunks in front of it load first
+    glm::vec3 viewDirection = glm::vec3(0.0f);
+
+    // World units per second, from the Velocity component or else from the Position deltas
+    glm::vec3 velocity = glm::vec3(0.0f);
+    glm::vec3 lastPosition = glm::vec3(0.0f);
+    // Look-ahead sphere around the predicted chunk while the loader moves, its chunks are referenced like the
+    // load sphere ones. A negative radius means there is no look-ahead sphere.
+    glm::ivec3 lastPrefetchChunk = glm::ivec3(INT32_MAX);
+    int lastPrefetchRadius = -1;
+
     [[nodiscard]] bool has_visited() const {
         return lastVisitedChunk != glm::ivec3(INT32_MAX);
     }
@@ -38,34 +54,41 @@ struct ChunkLoader {
 
 struct LoadedBy {};
 
+// Voxel value -> texture asset, shared by every chunk generated with the same table
+using VoxelTextureTable = std::unordered_map<AssetID, uint8_t>;
+
 struct VoxelChunk {
-    std::shared_ptr<std::array<uint8_t, CHUNK_VOLUME>> voxels;
-    std::unordered_map<AssetID, uint8_t> textureIDs;
+    // Copy-on-write: the meshing workers keep a reference to the storage while the chunk can keep being edited
+    std::shared_ptr<PalettedVoxelStorage> voxels;
+    std::shared_ptr<const VoxelTextureTable> textureIDs;
 
-    VoxelChunk() : voxels(std::make_shared<std::array<uint8_t, CHUNK_VOLUME>>()) {
-        voxels->fill(0);
-    }
+    bool dirty = false; // edited since it was loaded, has to be written back to the region store
+
+    VoxelChunk() : voxels(std::make_shared<PalettedVoxelStorage>(CHUNK_VOLUME)),
+                   textureIDs(empty_texture_table()) {}
 
     void ensure_unique() {
         if (voxels.use_count() > 1) {
-            voxels = std::make_shared<std::array<uint8_t, CHUNK_VOLUME>>(*voxels);
+            voxels = std::make_shared<PalettedVoxelStorage>(*voxels);
         }
     }
 
     void set(int x, int y, int z, uint8_t value) {
         ensure_unique();
-        (*voxels)[x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE] = value;
-    }
-
-    uint8_t& at(int x, int y, int z) {
-        return voxels->at(x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE);
+        voxels->set(index_of(x, y, z), value);
+        dirty = true;
     }
 
     uint8_t at(int x, int y, int z) const {
-        return voxels->at(x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE);
+        return voxels->get(index_of(x, y, z));
     }
-};
-
-
 
+    static uint32_t index_of(int x, int y, int z) {
+        return x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE;
+    }
 
+    static const std::shared_ptr<const VoxelTextureTable>& empty_texture_table() {
+        static const auto table = std::make_shared<const VoxelTextureTable>();
+        return table;
+    }
+};
@@ -30,7 +30,7 @@ PlatformModule::PlatformModule(flecs::world& ecs) {
 
             platform->window->pollEvents();
 
-            double currentTime = glfwGetTime();
+            double currentTime = get_time_seconds();
             gameState->deltaTime = currentTime - gameState->lastTime;
             gameState->lastTime = currentTime;
 
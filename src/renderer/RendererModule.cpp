@@ -3,6 +3,7 @@
 #include "Renderer.h"
 
 #include "core/GameState.h"
+#include "core/task/FrameBudget.h"
 #include "platform/PlatformState.h"
 #include "platform/events.h"
 
@@ -18,6 +19,7 @@
 #include "debug/LogConsole.h"
 #include "nvrhi/utils.h"
 #include "platform/inputs/input_state.h"
+#include "world/VoxelChunkMesher.h"
 
 
 RendererModule::RendererModule(flecs::world& ecs) {
@@ -41,7 +43,14 @@ RendererModule::RendererModule(flecs::world& ecs) {
 
             if (!renderer.backend) return;
 
-            if (renderer.backend->begin_frame(ctx.commandList)) {
+            // waits for the frame in flight fence and the swapchain image, not work of the frame
+            bool frameBegun;
+            {
+                FrameBudgetWaitScope waitScope(*e.world().get_mut<FrameBudget>());
+                frameBegun = renderer.backend->begin_frame(ctx.commandList);
+            }
+
+            if (frameBegun) {
                 ctx.commandList->open();
 
                 nvrhi::utils::ClearColorAttachment(ctx.commandList, renderer.backend->get_current_framebuffer(), 0, nvrhi::Color(0.1f, 0.1f, 0.4f, 1.0f));
@@ -95,6 +104,10 @@ RendererModule::RendererModule(flecs::world& ecs) {
 
 void shutdown_renderer(flecs::world& ecs) {
     LOG_INFO("RendererModule", "Shutting down...");
+    if (auto* mesher = ecs.get_mut<VoxelChunkMesher>()) {
+        mesher->shutdown();
+    }
+
     auto* renderer = ecs.get_mut<Renderer>();
     if (renderer) {
         if (renderer->voxelTerrainRenderer) {
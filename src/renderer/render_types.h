@@ -6,23 +6,25 @@ typedef struct Vertex3d {
     glm::vec3 position;
 } Vertex3d;
 
-struct TerrainVertex3d {
-    // Up to 1024 in each axis for a chunk (16x16x16 voxels, each voxel 64 units)
-    uint32_t x : 10;
-    uint32_t y : 10;
-    uint32_t z : 10;
-
-    // Corner
-    // {0,0} bottom left, {1,0} bottom right, {1,1} top right, {0,1} top left. A vertice can only have one UV coord, so we encode it in 2 bits.
-    uint32_t u : 1;
-    uint32_t v : 1;
-
-    ////////
-
-    uint16_t textureSlot : 13; // up to 8192 texture slots
-    uint16_t faceIndex : 3;   // 0-5 for the 6 cube faces
+// One visible quad of a chunk mesh. simple.vert pulls it from the face buffer and expands its 4 corners
+// from gl_VertexIndex (face = index / 4, corner = index % 4), so a face costs 8 bytes and no index data.
+struct TerrainFace {
+    // Voxel the face belongs to, 0..CHUNK_SIZE - 1 in each axis
+    uint32_t x : 5;
+    uint32_t y : 5;
+    uint32_t z : 5;
+
+    // Merged quad size in voxels minus one, along the face plane axes ((axis + 1) % 3 then (axis + 2) % 3)
+    uint32_t width : 5;
+    uint32_t height : 5;
+
+    uint32_t faceIndex : 3;  // 0-5 for the 6 cube faces
+    uint32_t uvRotation : 2; // corner the texture starts at, breaks the tiling pattern of single voxel faces
+    uint32_t positionPadding : 2 = 0;
 
     ////////
 
-    uint16_t padding = 0;
-};
\ No newline at end of file
+    uint32_t textureSlot : 13; // up to 8192 texture slots
+    uint32_t padding : 19 = 0;
+};
+static_assert(sizeof(TerrainFace) == 8, "TerrainFace must match the uvec2 read by simple.vert");
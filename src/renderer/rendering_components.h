@@ -2,6 +2,7 @@
 
 #include <vector>
 #include "render_types.h"
+#include "core/task/CancellationToken.h"
 
 struct Camera3dParameters {
     glm::float32 fov = 45.0f;
@@ -20,32 +21,38 @@ namespace voxel_chunk_mesh_state {
     struct Dirty {};
     struct Meshing {};
     struct ReadyForUpload {};
+    struct Uploading {}; // mesh data in flight on the UploadContext, drawn once resident
 }
 struct VoxelChunkMeshState {};
 
 struct VoxelChunkMesh {
-    // GPU side info
-    uint32_t bufferIndex = UINT32_MAX;
-
-    uint32_t vertexRegionStart = UINT32_MAX;
-    uint32_t vertexRegionCount = 0;
-
-    uint32_t indexRegionStart = UINT32_MAX;
-    uint32_t indexRegionCount = 0;
+    // GPU side info (regions of the terrain mesh arena)
+    uint32_t faceRegionStart = UINT32_MAX;
+    uint32_t faceRegionCount = 0;
 
     uint32_t drawSlotIndex = UINT32_MAX;
 
+    // Upload in flight (Uploading state), the draw slot is activated once the UploadContext completes this ticket
+    uint64_t uploadTicket = 0;
+    // Previous mesh of the chunk, still drawn until the new one is activated (detached from the defragmentation)
+    uint32_t previousDrawSlotIndex = UINT32_MAX;
+
     // CPU side info
-    std::vector<TerrainVertex3d> vertices;
-    std::vector<uint32_t> indices;
+    std::vector<TerrainFace> faces;
+    uint32_t faceCount = 0;
+
+    // Incremented for every meshing task, a built mesh is only applied if it comes from the latest one
+    uint32_t buildVersion = 0;
+    // Cancels the meshing task in flight, when it is replaced by a newer one or the chunk is unloaded
+    CancellationToken meshingCancellation;
 
-    uint32_t indexCount = 0;
-    uint32_t vertexCount = 0;
+    // Neighbors missing when the mesh was built (bit per face), their borders were meshed as air
+    uint8_t missingNeighbors = 0;
+    // A missing neighbor loaded while this mesh was being built, remesh once it is uploaded
+    bool remeshPending = false;
 
     bool is_allocated() const {
-        return vertexRegionStart != UINT32_MAX &&
-               indexRegionStart != UINT32_MAX &&
-               drawSlotIndex != UINT32_MAX &&
-               bufferIndex != UINT32_MAX;
+        return faceRegionStart != UINT32_MAX &&
+               drawSlotIndex != UINT32_MAX;
     }
 };
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "StagingRingBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "VulkanBackend.h"
+#include "core/log/Logger.h"
+
+StagingRingBuffer::StagingRingBuffer(VulkanBackend *backend, uint64_t capacity, const char *debugName) {
+    m_backend = backend;
+    m_capacity = capacity;
+
+    auto bufferDesc = nvrhi::BufferDesc()
+            .setByteSize(m_capacity)
+            .setDebugName(debugName)
+            .setCpuAccess(nvrhi::CpuAccessMode::Write)
+            .setInitialState(nvrhi::ResourceStates::CopySource)
+            .setKeepInitialState(true);
+    m_buffer = m_backend->device->createBuffer(bufferDesc);
+
+    // Stays mapped for the whole lifetime of the ring, the memory is host coherent
+    m_mappedData = static_cast<uint8_t*>(m_backend->device->mapBuffer(m_buffer, nvrhi::CpuAccessMode::Write));
+    if (!m_mappedData) {
+        LOG_FATAL("StagingRingBuffer", "Failed to map the staging ring buffer");
+        throw std::runtime_error("Failed to map the staging ring buffer");
+    }
+}
+
+StagingRingBuffer::~StagingRingBuffer() {
+    if (m_mappedData) {
+        m_backend->device->unmapBuffer(m_buffer);
+        m_mappedData = nullptr;
+    }
+    m_buffer = nullptr;
+}
+
+void StagingRingBuffer::begin_submission(uint64_t submission, uint64_t completedSubmission) {
+    m_submission = submission;
+    while (!m_submissionAllocations.empty() && m_submissionAllocations.front().submission <= completedSubmission) {
+        m_usedBytes -= m_submissionAllocations.front().byteCount;
+        m_submissionAllocations.pop_front();
+    }
+}
+
+bool StagingRingBuffer::allocate(uint64_t size, uint64_t &outOffset) {
+    size = (size + STAGING_RING_ALIGNMENT - 1) & ~(STAGING_RING_ALIGNMENT - 1);
+    if (size > m_capacity) return false;
+
+    // The bytes in use are the ones before the head (wrapping), so the free bytes always start at the head.
+    // The end of the ring is skipped when too small, these bytes are given back with the frame.
+    uint64_t wasted = 0;
+    if (m_head + size > m_capacity) {
+        wasted = m_capacity - m_head;
+    }
+    if (m_usedBytes + wasted + size > m_capacity) {
+        return false;
+    }
+
+    if (wasted > 0) {
+        m_head = 0;
+    }
+    outOffset = m_head;
+    m_head = (m_head + size) % m_capacity;
+    m_usedBytes += wasted + size;
+
+    if (m_submissionAllocations.empty() || m_submissionAllocations.back().submission != m_submission) {
+        m_submissionAllocations.push_back({m_submission, 0});
+    }
+    m_submissionAllocations.back().byteCount += wasted + size;
+
+    return true;
+}
+
+bool StagingRingBuffer::stage_copy(nvrhi::IBuffer *destination, uint64_t destinationOffset, const void *data, uint64_t size) {
+    if (size == 0) return true;
+
+    uint64_t stagingOffset;
+    if (!allocate(size, stagingOffset)) {
+        return false;
+    }
+
+    std::memcpy(m_mappedData + stagingOffset, data, size);
+
+    m_pendingCopies.push_back({
+        .destination = destination,
+        .region = {
+            .srcOffset = stagingOffset,
+            .dstOffset = destinationOffset,
+            .size = size
+        }
+    });
+    if (m_pendingDestinations.empty() || m_pendingDestinations.back() != destination) {
+        m_pendingDestinations.emplace_back(destination);
+    }
+    return true;
+}
+
+bool StagingRingBuffer::has_overlapping_regions(std::vector<VkBufferCopy> regions) {
+    std::sort(regions.begin(), regions.end(),
+              [](const VkBufferCopy &a, const VkBufferCopy &b) { return a.dstOffset < b.dstOffset; });
+    for (size_t i = 1; i < regions.size(); i++) {
+        if (regions[i - 1].dstOffset + regions[i - 1].size > regions[i].dstOffset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StagingRingBuffer::flush(nvrhi::CommandListHandle cmd) {
+    if (m_pendingCopies.empty()) return;
+
+    // Group the copies by destination, keeping the submission order inside a group
+    std::stable_sort(m_pendingCopies.begin(), m_pendingCopies.end(),
+                     [](const PendingCopy &a, const PendingCopy &b) { return a.destination < b.destination; });
+
+    // The native copies can't be recorded in a render pass, clearState() ends the one NVRHI may have open
+    cmd->clearState();
+
+    // A single transition per destination, then the copies are recorded on the native command buffer
+    cmd->setBufferState(m_buffer, nvrhi::ResourceStates::CopySource);
+    for (size_t i = 0; i < m_pendingCopies.size(); i++) {
+        if (i == 0 || m_pendingCopies[i].destination != m_pendingCopies[i - 1].destination) {
+            cmd->setBufferState(m_pendingCopies[i].destination, nvrhi::ResourceStates::CopyDest);
+        }
+    }
+    cmd->commitBarriers();
+
+    auto vkCommandBuffer = static_cast<VkCommandBuffer>(
+        cmd->getNativeObject(nvrhi::ObjectTypes::VK_CommandBuffer).pointer);
+    auto vkStagingBuffer = static_cast<VkBuffer>(
+        m_buffer->getNativeObject(nvrhi::ObjectTypes::VK_Buffer).pointer);
+
+    size_t first = 0;
+    while (first < m_pendingCopies.size()) {
+        nvrhi::IBuffer *destination = m_pendingCopies[first].destination;
+
+        m_regions.clear();
+        size_t last = first;
+        while (last < m_pendingCopies.size() && m_pendingCopies[last].destination == destination) {
+            m_regions.push_back(m_pendingCopies[last].region);
+            last++;
+        }
+
+        auto vkDestination = static_cast<VkBuffer>(destination->getNativeObject(nvrhi::ObjectTypes::VK_Buffer).pointer);
+        if (!has_overlapping_regions(m_regions)) {
+            vkCmdCopyBuffer(vkCommandBuffer, vkStagingBuffer, vkDestination,
+                            static_cast<uint32_t>(m_regions.size()), m_regions.data());
+        } else {
+            // The regions of one copy are not ordered, a range written twice (freed and reused in the same frame)
+            // is copied in submission order with a barrier in between so the last write wins
+            VkMemoryBarrier barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+            };
+            for (size_t i = first; i < last; i++) {
+                if (i > first) {
+                    vkCmdPipelineBarrier(vkCommandBuffer,
+                                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+                }
+                vkCmdCopyBuffer(vkCommandBuffer, vkStagingBuffer, vkDestination, 1, &m_pendingCopies[i].region);
+            }
+        }
+        first = last;
+    }
+
+    m_pendingCopies.clear();
+    m_pendingDestinations.clear();
+}
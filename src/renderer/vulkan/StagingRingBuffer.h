@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "nvrhi/nvrhi.h"
+#include <vulkan/vulkan_core.h>
+
+class VulkanBackend;
+
+static constexpr uint64_t STAGING_RING_SIZE = 32 * 1024 * 1024; // 32 MB
+static constexpr uint64_t STAGING_RING_ALIGNMENT = 16;
+
+/**
+ * Persistently mapped upload buffer used as a ring: the data of a submission (a frame, an upload batch...) is
+ * written to the head, and the space is given back once the GPU finished that submission (see begin_submission).
+ * The copies are recorded by flush(), one vkCmdCopyBuffer with all the regions of a destination buffer,
+ * after a single state transition per destination.
+ */
+class StagingRingBuffer {
+public:
+    StagingRingBuffer(VulkanBackend* backend, uint64_t capacity = STAGING_RING_SIZE,
+                      const char* debugName = "Staging Ring Buffer");
+    ~StagingRingBuffer();
+
+    StagingRingBuffer(const StagingRingBuffer&) = delete;
+    StagingRingBuffer& operator=(const StagingRingBuffer&) = delete;
+
+    /**
+     * Start staging the data of a new submission, and give back the space of the completed ones
+     * @param submission Number of the submission the next staged data belongs to, increasing
+     * @param completedSubmission Last submission whose copies are done on the GPU
+     */
+    void begin_submission(uint64_t submission, uint64_t completedSubmission);
+
+    /**
+     * Copy data into the ring and queue its copy to the destination, recorded by the next flush()
+     * @param destination Buffer receiving the data
+     * @param destinationOffset Byte offset in the destination
+     * @param data Data to upload
+     * @param size Size of the data in bytes
+     * @return True if the data was staged, false if the ring is full (the caller must upload it another way)
+     */
+    bool stage_copy(nvrhi::IBuffer* destination, uint64_t destinationOffset, const void* data, uint64_t size);
+
+    /**
+     * Record every queued copy into the command list. The destinations are left in the CopyDest state,
+     * NVRHI transitions them when they are used next.
+     * @param cmd Command list to record the copies
+     */
+    void flush(nvrhi::CommandListHandle cmd);
+
+    bool has_pending_copies() const { return !m_pendingCopies.empty(); }
+
+    uint64_t get_capacity() const { return m_capacity; }
+    uint64_t get_used_bytes() const { return m_usedBytes; }
+
+private:
+    struct SubmissionAllocation {
+        uint64_t submission;
+        uint64_t byteCount; // bytes of the ring used by the submission, wasted space at the end included
+    };
+
+    struct PendingCopy {
+        nvrhi::IBuffer* destination;
+        VkBufferCopy region;
+    };
+
+    VulkanBackend* m_backend;
+
+    nvrhi::BufferHandle m_buffer;
+    uint8_t* m_mappedData = nullptr;
+
+    uint64_t m_capacity;
+    uint64_t m_head = 0;      // next byte written
+    uint64_t m_usedBytes = 0; // bytes between the oldest submission still in use and the head
+
+    uint64_t m_submission = 1;
+    std::deque<SubmissionAllocation> m_submissionAllocations;
+
+    std::vector<PendingCopy> m_pendingCopies;
+    std::vector<nvrhi::BufferHandle> m_pendingDestinations; // keeps the destinations alive until the flush
+    std::vector<VkBufferCopy> m_regions;
+
+    /**
+     * Reserve contiguous bytes at the head, wrapping to the start when the end is too small
+     * @return True if the bytes were reserved
+     */
+    bool allocate(uint64_t size, uint64_t& outOffset);
+
+    // Test if two copies write the same bytes of their destination
+    static bool has_overlapping_regions(std::vector<VkBufferCopy> regions);
+};
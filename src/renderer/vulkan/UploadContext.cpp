@@ -0,0 +1,66 @@
+#include "UploadContext.h"
+
+#include "VulkanBackend.h"
+#include "core/log/Logger.h"
+
+UploadContext::UploadContext(VulkanBackend *backend)
+    : m_backend(backend),
+      m_queue(backend->transferQueueSupported ? nvrhi::CommandQueue::Copy : nvrhi::CommandQueue::Graphics),
+      m_stagingRing(backend, STAGING_RING_SIZE, "Upload Staging Ring Buffer") {
+    m_commandList = m_backend->device->createCommandList(
+        nvrhi::CommandListParameters().setQueueType(m_queue));
+    m_stagingRing.begin_submission(m_nextTicket, m_completedTicket);
+
+    LOG_INFO("UploadContext", "Uploads submitted on the {} queue", is_async() ? "transfer" : "graphics");
+}
+
+UploadContext::~UploadContext() {
+    for (const Submission &submission : m_submissions) {
+        m_backend->device->waitEventQuery(submission.query);
+    }
+    m_submissions.clear();
+    m_queryPool.clear();
+    m_commandList = nullptr;
+}
+
+bool UploadContext::stage_copy(nvrhi::IBuffer *destination, uint64_t destinationOffset, const void *data, uint64_t size) {
+    return m_stagingRing.stage_copy(destination, destinationOffset, data, size);
+}
+
+uint64_t UploadContext::submit() {
+    if (!m_stagingRing.has_pending_copies()) return 0;
+
+    m_commandList->open();
+    m_stagingRing.flush(m_commandList);
+    m_commandList->close();
+    const uint64_t submissionId = m_backend->device->executeCommandList(m_commandList, m_queue);
+
+    nvrhi::EventQueryHandle query;
+    if (!m_queryPool.empty()) {
+        query = m_queryPool.back();
+        m_queryPool.pop_back();
+    } else {
+        query = m_backend->device->createEventQuery();
+    }
+    m_backend->device->resetEventQuery(query);
+    m_backend->device->setEventQuery(query, m_queue);
+
+    const uint64_t ticket = m_nextTicket++;
+    m_submissions.push_back({ticket, submissionId, query});
+    m_stagingRing.begin_submission(m_nextTicket, m_completedTicket);
+    return ticket;
+}
+
+void UploadContext::update() {
+    while (!m_submissions.empty() && m_backend->device->pollEventQuery(m_submissions.front().query)) {
+        const Submission &submission = m_submissions.front();
+        if (is_async()) {
+            // makes the transfer queue writes visible to the graphics queue
+            m_backend->device->queueWaitForCommandList(nvrhi::CommandQueue::Graphics, m_queue, submission.submissionId);
+        }
+        m_completedTicket = submission.ticket;
+        m_queryPool.push_back(submission.query);
+        m_submissions.pop_front();
+    }
+    m_stagingRing.begin_submission(m_nextTicket, m_completedTicket);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "StagingRingBuffer.h"
+#include "nvrhi/nvrhi.h"
+
+class VulkanBackend;
+
+/**
+ * Uploads recorded outside of the frame command list, in their own command list submitted on the
+ * transfer queue (the graphics queue if the device has none). Each submit() returns a ticket,
+ * the data of the ticket can be read by the frames once is_complete() returns true.
+ * Only copies are recorded, the destinations must keep the CopyDest state between two uses
+ * (keepInitialState), the transfer queue can't transition to the graphics states.
+ */
+class UploadContext {
+public:
+    explicit UploadContext(VulkanBackend* backend);
+    ~UploadContext();
+
+    UploadContext(const UploadContext&) = delete;
+    UploadContext& operator=(const UploadContext&) = delete;
+
+    /**
+     * Queue a copy for the next submit()
+     * @return True if the data was staged, false if the staging ring is full
+     */
+    bool stage_copy(nvrhi::IBuffer* destination, uint64_t destinationOffset, const void* data, uint64_t size);
+
+    /**
+     * Submit the copies staged since the last submit, without waiting for them
+     * @return Ticket of the submission, 0 if nothing was staged
+     */
+    uint64_t submit();
+
+    /**
+     * Look for finished submissions. The graphics queue is made to wait for them before its next
+     * submission, so their data is visible to the frames (no stall, they are already done).
+     */
+    void update();
+
+    /**
+     * Ticket the copies staged now will complete with
+     */
+    uint64_t get_pending_ticket() const { return m_nextTicket; }
+    bool is_complete(uint64_t ticket) const { return ticket <= m_completedTicket; }
+
+    size_t get_in_flight_count() const { return m_submissions.size(); }
+    bool is_async() const { return m_queue != nvrhi::CommandQueue::Graphics; }
+
+private:
+    struct Submission {
+        uint64_t ticket;
+        uint64_t submissionId; // NVRHI submission on m_queue
+        nvrhi::EventQueryHandle query;
+    };
+
+    VulkanBackend* m_backend;
+    nvrhi::CommandQueue m_queue;
+    nvrhi::CommandListHandle m_commandList;
+    StagingRingBuffer m_stagingRing;
+
+    std::deque<Submission> m_submissions;
+    std::vector<nvrhi::EventQueryHandle> m_queryPool;
+
+    uint64_t m_nextTicket = 1;
+    uint64_t m_completedTicket = 0;
+};
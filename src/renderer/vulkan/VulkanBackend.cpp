@@ -102,7 +102,7 @@ VulkanBackend::~VulkanBackend() {
 
     // Drain all frames in flight - wait for all pending NVRHI queries
     while (!m_framesInFlight.empty()) {
-        auto query = m_framesInFlight.front();
+        auto query = m_framesInFlight.front().query;
         m_framesInFlight.pop();
         device->waitEventQuery(query);
     }
@@ -158,9 +158,22 @@ void VulkanBackend::init_nvrhi() {
     vkb::PhysicalDevice physicalDevice = physicalDevice_ret.value();
     LOG_INFO("VulkanBackend", "Selected GPU: {}", physicalDevice.properties.deviceName);
 
-    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
-    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
-    timelineFeatures.timelineSemaphore = VK_TRUE;
+    // drawIndirectCount is optional, only the GPU terrain culling needs it
+    VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+    supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 supportedFeatures{};
+    supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures.pNext = &supportedFeatures12;
+    vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures);
+    drawIndirectCountSupported = supportedFeatures12.drawIndirectCount == VK_TRUE;
+    if (!drawIndirectCountSupported) {
+        LOG_WARN("VulkanBackend", "drawIndirectCount is not supported, GPU terrain culling disabled");
+    }
+
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.timelineSemaphore = VK_TRUE;
+    features12.drawIndirectCount = drawIndirectCountSupported ? VK_TRUE : VK_FALSE;
 
     VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures{};
     dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
@@ -172,7 +185,7 @@ void VulkanBackend::init_nvrhi() {
 
     vkb::DeviceBuilder deviceBuilder{ physicalDevice };
     auto device_ret = deviceBuilder
-        .add_pNext(&timelineFeatures)
+        .add_pNext(&features12)
         .add_pNext(&dynamicRenderingFeatures)
         .add_pNext(&features)
         .build();
@@ -209,6 +222,18 @@ void VulkanBackend::init_nvrhi() {
     deviceDesc.device = vkDevice;
     deviceDesc.graphicsQueue = graphicsQueue;
     deviceDesc.graphicsQueueIndex = graphicsQueueIndex_ret.value();
+
+    // Optional, the uploads fall back to the graphics queue without it
+    auto transferQueue_ret = vkDevice.get_dedicated_queue(vkb::QueueType::transfer);
+    auto transferQueueIndex_ret = vkDevice.get_dedicated_queue_index(vkb::QueueType::transfer);
+    if (transferQueue_ret && transferQueueIndex_ret) {
+        transferQueue = transferQueue_ret.value();
+        deviceDesc.transferQueue = transferQueue;
+        deviceDesc.transferQueueIndex = transferQueueIndex_ret.value();
+        transferQueueSupported = true;
+    } else {
+        LOG_INFO("VulkanBackend", "No dedicated transfer queue, uploads will use the graphics queue");
+    }
     deviceDesc.errorCB = new DefaultMessageCallback();
 
     this->device = nvrhi::vulkan::createDevice(deviceDesc);
@@ -437,12 +462,20 @@ bool VulkanBackend::present() {
 
     // Drain old frames before creating new query
     while (m_framesInFlight.size() >= MAX_FRAMES_IN_FLIGHT) {
-        auto query = m_framesInFlight.front();
+        auto frame = m_framesInFlight.front();
         m_framesInFlight.pop();
 
-        device->waitEventQuery(query);
+        device->waitEventQuery(frame.query);
+        m_completedFrameNumber = frame.frameNumber;
+
+        m_queryPool.push_back(frame.query);
+    }
 
-        m_queryPool.push_back(query);
+    // Older frames may be done already, without waiting
+    while (!m_framesInFlight.empty() && device->pollEventQuery(m_framesInFlight.front().query)) {
+        m_completedFrameNumber = m_framesInFlight.front().frameNumber;
+        m_queryPool.push_back(m_framesInFlight.front().query);
+        m_framesInFlight.pop();
     }
 
     // Track this frame in flight
@@ -457,7 +490,8 @@ bool VulkanBackend::present() {
 
     device->resetEventQuery(query);
     device->setEventQuery(query, nvrhi::CommandQueue::Graphics);
-    m_framesInFlight.push(query);
+    m_framesInFlight.push({query, m_frameNumber});
+    m_frameNumber++;
 
     device->runGarbageCollection();
 
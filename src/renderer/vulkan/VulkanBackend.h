@@ -32,10 +32,16 @@ public:
 
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue transferQueue = VK_NULL_HANDLE;
 
     VkSurfaceKHR surface;
     VkFormat swapchainFormat = VK_FORMAT_R8G8B8A8_UNORM;
 
+    // vkCmdDrawIndexedIndirectCount can be used (Vulkan 1.2 drawIndirectCount feature)
+    bool drawIndirectCountSupported = false;
+    // A dedicated transfer queue was found, NVRHI command lists can use CommandQueue::Copy
+    bool transferQueueSupported = false;
+
     /**
      * @param surface Pointer to a VkSurfaceKHR created from a GLFW window
      */
@@ -57,6 +63,17 @@ public:
 
     void handle_resize(uint32_t width, uint32_t height);
 
+    /**
+     * Number of the frame being recorded, starts at 1 and is incremented by present()
+     */
+    uint64_t get_frame_number() const { return m_frameNumber; }
+
+    /**
+     * Number of the last frame whose GPU work is finished (0 if none yet). Resources used by
+     * a frame up to this number can be reused.
+     */
+    uint64_t get_completed_frame_number() const { return m_completedFrameNumber; }
+
 private:
     // Swapchain
     bool m_swapchainDirty = false;
@@ -79,7 +96,13 @@ private:
     // Syncs
     std::vector<VkSemaphore> m_acquireImageSemaphores; // for each frame in flight
     std::vector<VkSemaphore> m_presentSemaphores; // for each swapchain image
-    std::queue<nvrhi::EventQueryHandle> m_framesInFlight; // to track frames in flight
+    struct FrameInFlight {
+        nvrhi::EventQueryHandle query;
+        uint64_t frameNumber;
+    };
+    std::queue<FrameInFlight> m_framesInFlight; // to track frames in flight
+    uint64_t m_frameNumber = 1;
+    uint64_t m_completedFrameNumber = 0;
     std::vector<nvrhi::EventQueryHandle> m_queryPool;
 
     void init_nvrhi();
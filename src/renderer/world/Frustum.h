@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// View frustum as 6 planes (xyz = inward normal, w = distance), extracted from a view-projection matrix
+struct Frustum {
+    glm::vec4 planes[6];
+
+    /**
+     * Extract the planes of the frustum (Gribb & Hartmann). Points inside satisfy dot(plane.xyz, p) + plane.w >= 0.
+     * The near plane is taken for a [-1, 1] clip depth, it is only looser with a [0, 1] depth.
+     * @param viewProjection projection * view matrix of the camera
+     */
+    static Frustum from_matrix(const glm::mat4& viewProjection) {
+        // glm is column major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        auto row = [&](int i) {
+            return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        };
+        const glm::vec4 r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+        Frustum frustum;
+        frustum.planes[0] = r3 + r0; // left
+        frustum.planes[1] = r3 - r0; // right
+        frustum.planes[2] = r3 + r1; // bottom
+        frustum.planes[3] = r3 - r1; // top
+        frustum.planes[4] = r3 + r2; // near
+        frustum.planes[5] = r3 - r2; // far
+
+        for (glm::vec4& plane : frustum.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+        return frustum;
+    }
+};
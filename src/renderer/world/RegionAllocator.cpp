@@ -0,0 +1,197 @@
+#include "RegionAllocator.h"
+
+#include <bit>
+#include <cassert>
+
+RegionAllocator::RegionAllocator(uint32_t capacity) {
+    reset(capacity);
+}
+
+void RegionAllocator::reset(uint32_t capacity) {
+    m_blockSize.assign(capacity, 0);
+    m_blockFree.assign(capacity, 0);
+    m_nextFree.assign(capacity, INVALID_REGION);
+    m_prevFree.assign(capacity, INVALID_REGION);
+    m_blockStartAtEnd.assign(capacity, INVALID_REGION);
+
+    m_flBitmap = 0;
+    m_slBitmaps.fill(0);
+    for (auto& heads : m_freeHeads) {
+        heads.fill(INVALID_REGION);
+    }
+
+    m_stats = {};
+    m_stats.capacity = capacity;
+
+    if (capacity > 0) {
+        insert_free_block(0, capacity);
+    }
+}
+
+RegionAllocator::BinIndex RegionAllocator::bin_of(uint32_t size) {
+    // small sizes are binned linearly in the first level
+    if (size < SL_COUNT) {
+        return {0, size};
+    }
+    const uint32_t log2 = std::bit_width(size) - 1;
+    return {log2 - SL_LOG2 + 1, (size >> (log2 - SL_LOG2)) - SL_COUNT};
+}
+
+RegionAllocator::BinIndex RegionAllocator::bin_at_least(uint32_t size) {
+    if (size >= SL_COUNT) {
+        // round up to the next bin boundary so any block of the bin fits
+        const uint32_t log2 = std::bit_width(size) - 1;
+        const uint64_t rounded = static_cast<uint64_t>(size) + (1u << (log2 - SL_LOG2)) - 1;
+        if (rounded > UINT32_MAX) return {FL_COUNT, 0};
+        size = static_cast<uint32_t>(rounded);
+    }
+    return bin_of(size);
+}
+
+bool RegionAllocator::find_free_bin(BinIndex bin, BinIndex &outBin) const {
+    if (bin.fl >= FL_COUNT) return false;
+
+    // a bin of the same first level
+    uint32_t slMap = m_slBitmaps[bin.fl] & (~0u << bin.sl);
+    if (slMap == 0) {
+        // otherwise the smallest bin of a higher first level
+        const uint32_t flMap = bin.fl + 1 < FL_COUNT ? m_flBitmap & (~0u << (bin.fl + 1)) : 0;
+        if (flMap == 0) return false;
+
+        bin.fl = std::countr_zero(flMap);
+        slMap = m_slBitmaps[bin.fl];
+    }
+
+    outBin = {bin.fl, static_cast<uint32_t>(std::countr_zero(slMap))};
+    return true;
+}
+
+void RegionAllocator::insert_free_block(uint32_t start, uint32_t size) {
+    const BinIndex bin = bin_of(size);
+    const uint32_t head = m_freeHeads[bin.fl][bin.sl];
+
+    m_blockSize[start] = size;
+    m_blockFree[start] = 1;
+    m_blockStartAtEnd[start + size - 1] = start;
+
+    m_prevFree[start] = INVALID_REGION;
+    m_nextFree[start] = head;
+    if (head != INVALID_REGION) {
+        m_prevFree[head] = start;
+    }
+    m_freeHeads[bin.fl][bin.sl] = start;
+
+    m_flBitmap |= 1u << bin.fl;
+    m_slBitmaps[bin.fl] |= 1u << bin.sl;
+
+    m_stats.freeRegions += size;
+    m_stats.freeBlockCount++;
+}
+
+void RegionAllocator::remove_free_block(uint32_t start) {
+    const uint32_t size = m_blockSize[start];
+    const BinIndex bin = bin_of(size);
+    const uint32_t prev = m_prevFree[start];
+    const uint32_t next = m_nextFree[start];
+
+    if (prev != INVALID_REGION) {
+        m_nextFree[prev] = next;
+    } else {
+        m_freeHeads[bin.fl][bin.sl] = next;
+        if (next == INVALID_REGION) {
+            m_slBitmaps[bin.fl] &= ~(1u << bin.sl);
+            if (m_slBitmaps[bin.fl] == 0) {
+                m_flBitmap &= ~(1u << bin.fl);
+            }
+        }
+    }
+    if (next != INVALID_REGION) {
+        m_prevFree[next] = prev;
+    }
+
+    m_blockFree[start] = 0;
+    m_stats.freeRegions -= size;
+    m_stats.freeBlockCount--;
+}
+
+bool RegionAllocator::allocate(uint32_t count, uint32_t &outStart) {
+    if (count == 0) return false;
+
+    BinIndex bin;
+    if (!find_free_bin(bin_at_least(count), bin)) {
+        return false;
+    }
+
+    const uint32_t start = m_freeHeads[bin.fl][bin.sl];
+    const uint32_t size = m_blockSize[start];
+    assert(size >= count);
+    remove_free_block(start);
+
+    // give back the tail of the block
+    if (size > count) {
+        insert_free_block(start + count, size - count);
+    }
+
+    m_blockSize[start] = count;
+    m_blockStartAtEnd[start + count - 1] = start;
+
+    m_stats.usedRegions += count;
+    m_stats.allocationCount++;
+
+    outStart = start;
+    return true;
+}
+
+void RegionAllocator::free(uint32_t start, uint32_t count) {
+    if (count == 0 || start >= m_stats.capacity) return;
+    assert(!m_blockFree[start] && m_blockSize[start] == count);
+
+    m_stats.usedRegions -= count;
+    m_stats.allocationCount--;
+
+    uint32_t blockStart = start;
+    uint32_t blockSize = count;
+
+    // merge with the next block
+    const uint32_t next = start + count;
+    if (next < m_stats.capacity && m_blockFree[next]) {
+        blockSize += m_blockSize[next];
+        remove_free_block(next);
+    }
+
+    // merge with the previous block
+    if (start > 0) {
+        const uint32_t previous = m_blockStartAtEnd[start - 1];
+        if (m_blockFree[previous]) {
+            blockStart = previous;
+            blockSize += m_blockSize[previous];
+            remove_free_block(previous);
+        }
+    }
+
+    insert_free_block(blockStart, blockSize);
+}
+
+bool RegionAllocator::can_allocate(uint32_t count) const {
+    if (count == 0) return false;
+    BinIndex bin;
+    return find_free_bin(bin_at_least(count), bin);
+}
+
+bool RegionAllocator::is_between_free_blocks(uint32_t start, uint32_t count) const {
+    if (start == 0 || start + count >= m_stats.capacity) return false;
+    return m_blockFree[m_blockStartAtEnd[start - 1]] && m_blockFree[start + count];
+}
+
+uint32_t RegionAllocator::get_largest_free_block() const {
+    if (m_flBitmap == 0) return 0;
+
+    const uint32_t fl = 31 - std::countl_zero(m_flBitmap);
+    const uint32_t sl = 31 - std::countl_zero(m_slBitmaps[fl]);
+
+    uint32_t largest = 0;
+    for (uint32_t block = m_freeHeads[fl][sl]; block != INVALID_REGION; block = m_nextFree[block]) {
+        if (m_blockSize[block] > largest) largest = m_blockSize[block];
+    }
+    return largest;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Live statistics of a RegionAllocator, kept up to date on every allocation and free
+struct RegionAllocatorStats {
+    uint32_t capacity = 0;       // total regions managed
+    uint32_t usedRegions = 0;
+    uint32_t freeRegions = 0;
+    uint32_t freeBlockCount = 0; // number of free blocks, 1 means no fragmentation
+    uint32_t allocationCount = 0;
+};
+
+/**
+ * Two-level segregated fit (TLSF) allocator of contiguous regions in [0, capacity).
+ * Free blocks are binned by size class (power of two, split in SL_COUNT linear steps), with a bitmap per level
+ * to find a bin big enough in O(1). Freed blocks are merged with their free physical neighbors in O(1).
+ * It only works on region indices, the caller maps them to the bytes of its buffer.
+ */
+class RegionAllocator {
+public:
+    static constexpr uint32_t INVALID_REGION = UINT32_MAX;
+
+    explicit RegionAllocator(uint32_t capacity = 0);
+
+    /**
+     * Forget every allocation, the whole range becomes a single free block
+     * @param capacity Number of regions managed
+     */
+    void reset(uint32_t capacity);
+
+    /**
+     * Allocate contiguous regions
+     * @param count Number of regions to allocate
+     * @param outStart First allocated region
+     * @return True if the allocation succeeded, false if no free block is big enough
+     */
+    bool allocate(uint32_t count, uint32_t& outStart);
+
+    /**
+     * Free an allocation previously returned by allocate()
+     * @param start First region of the allocation
+     * @param count Number of regions, must match the allocation
+     */
+    void free(uint32_t start, uint32_t count);
+
+    /**
+     * Test if an allocation of count regions would succeed, without allocating
+     */
+    bool can_allocate(uint32_t count) const;
+
+    /**
+     * Test if an allocation has a free block on both sides, freeing it would merge them into one
+     * @param start First region of the allocation
+     * @param count Number of regions of the allocation
+     */
+    bool is_between_free_blocks(uint32_t start, uint32_t count) const;
+
+    const RegionAllocatorStats& get_stats() const { return m_stats; }
+
+    /**
+     * Size of the largest free block. Only the highest non empty bin is looked at.
+     */
+    uint32_t get_largest_free_block() const;
+
+    /**
+     * Visit the free blocks in address order (walks every block, for debug views)
+     * @param visitor Called with (start, count) of each free block
+     */
+    template<typename Visitor>
+    void for_each_free_block(Visitor&& visitor) const {
+        for (uint32_t start = 0; start < m_stats.capacity; start += m_blockSize[start]) {
+            if (m_blockFree[start]) visitor(start, m_blockSize[start]);
+        }
+    }
+
+private:
+    static constexpr uint32_t SL_LOG2 = 4;
+    static constexpr uint32_t SL_COUNT = 1u << SL_LOG2;
+    static constexpr uint32_t FL_COUNT = 32;
+
+    struct BinIndex {
+        uint32_t fl;
+        uint32_t sl;
+    };
+
+    // Bin holding blocks of this size
+    static BinIndex bin_of(uint32_t size);
+    // First bin whose blocks are all at least this size
+    static BinIndex bin_at_least(uint32_t size);
+
+    // Non empty bin at or above `bin`, false if none
+    bool find_free_bin(BinIndex bin, BinIndex& outBin) const;
+
+    void insert_free_block(uint32_t start, uint32_t size);
+    void remove_free_block(uint32_t start);
+
+    // Block metadata indexed by the first region of the block (only valid at block starts)
+    std::vector<uint32_t> m_blockSize;
+    std::vector<uint8_t> m_blockFree;
+    std::vector<uint32_t> m_nextFree;
+    std::vector<uint32_t> m_prevFree;
+    // First region of the block ending at this region (only valid at block ends), to merge with the previous block
+    std::vector<uint32_t> m_blockStartAtEnd;
+
+    uint32_t m_flBitmap = 0;
+    std::array<uint32_t, FL_COUNT> m_slBitmaps{};
+    std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> m_freeHeads{};
+
+    RegionAllocatorStats m_stats;
+};
@@ -3,11 +3,15 @@
 //
 
 #include "VoxelBuffer.h"
+
+#include <algorithm>
+
 #include "../rendering_components.h"
 #include "core/log/Logger.h"
 
-VoxelBuffer::VoxelBuffer(VulkanBackend* backend) {
+VoxelBuffer::VoxelBuffer(VulkanBackend* backend, StagingRingBuffer* stagingRing) {
     this->m_backend = backend;
+    this->m_stagingRing = stagingRing;
     init();
 }
 
@@ -17,11 +21,7 @@ VoxelBuffer::~VoxelBuffer() {
 
 
 void VoxelBuffer::init() {
-    m_freeVertexRegions.clear();
-    m_freeVertexRegions.emplace_back(0, MAX_VERTEX_REGION);
-
-    m_freeIndexRegions.clear();
-    m_freeIndexRegions.emplace_back(0, MAX_INDEX_REGION);
+    m_faceAllocator.reset(MAX_FACE_REGION);
 
     m_freeDrawSlots.clear();
     m_nextDrawSlot = 0;
@@ -29,14 +29,13 @@ void VoxelBuffer::init() {
     auto meshDesc = nvrhi::BufferDesc()
             .setByteSize(TOTAL_BUFFER_SIZE)
             .setDebugName("VoxelBuffer Mesh Buffer")
-            .setIsVertexBuffer(true)
-            .setIsIndexBuffer(true)
+            .setStructStride(sizeof(TerrainFace)) // pulled by the vertex shader
             .setInitialState(nvrhi::ResourceStates::CopyDest)
             .setKeepInitialState(true);
     m_meshBuffer = m_backend->device->createBuffer(meshDesc);
 
     auto oubDesc = nvrhi::BufferDesc()
-            .setByteSize(8 * 1024 * 1024) // 8 MB
+            .setByteSize(MAX_DRAW_SLOTS * sizeof(TerrainOUB)) // 2 MB
             .setDebugName("VoxelBuffer OUB Buffer")
             .setInitialState(nvrhi::ResourceStates::ShaderResource)
             .setIsConstantBuffer(false) // structured buffer
@@ -45,119 +44,81 @@ void VoxelBuffer::init() {
     m_oubBuffer = m_backend->device->createBuffer(oubDesc);
 
     auto indirectDesc = nvrhi::BufferDesc()
-            .setByteSize(8 * 1024 * 1024 / sizeof(TerrainOUB) * sizeof(nvrhi::DrawIndexedIndirectArguments)) // 2.5 MB
+            .setByteSize(MAX_DRAW_SLOTS * sizeof(nvrhi::DrawIndexedIndirectArguments)) // 2.5 MB
             .setDebugName("VoxelBuffer Indirect Buffer")
             .setInitialState(nvrhi::ResourceStates::IndirectArgument)
             .setIsDrawIndirectArgs(true)
+            .setStructStride(sizeof(nvrhi::DrawIndexedIndirectArguments)) // read by the GPU culling
             .setKeepInitialState(true);
     m_indirectBuffer = m_backend->device->createBuffer(indirectDesc);
-}
-
-bool VoxelBuffer::can_allocate(uint32_t vertexCount, uint32_t indexCount) {
-    uint32_t vertexRegionsNeeded = (vertexCount + VERTICES_PER_REGION - 1) / VERTICES_PER_REGION;
-    uint32_t indexRegionsNeeded = (indexCount + (INDEX_REGION_SIZE / INDEX_SIZE) - 1) / (
-                                      INDEX_REGION_SIZE / INDEX_SIZE);
 
-    bool hasVertexSpace = false;
-    bool hasIndexSpace = false;
-    // bool hasIndirectSpace = false;
+    indirectDesc.setDebugName("VoxelBuffer Visible Indirect Buffer");
+    m_visibleIndirectBuffer = m_backend->device->createBuffer(indirectDesc);
 
-    for (const auto &[start, count]: m_freeVertexRegions) {
-        if (count >= vertexRegionsNeeded) {
-            hasVertexSpace = true;
-            break;
-        }
-    }
-
-    for (const auto &[start, count]: m_freeIndexRegions) {
-        if (count >= indexRegionsNeeded) {
-            hasIndexSpace = true;
-            break;
-        }
-    }
+    auto boundsDesc = nvrhi::BufferDesc()
+            .setByteSize(MAX_DRAW_SLOTS * sizeof(TerrainCullBounds)) // 4 MB
+            .setDebugName("VoxelBuffer Bounds Buffer")
+            .setInitialState(nvrhi::ResourceStates::ShaderResource)
+            .setStructStride(sizeof(TerrainCullBounds))
+            .setKeepInitialState(true);
+    m_boundsBuffer = m_backend->device->createBuffer(boundsDesc);
 
-    // if (!hasVertexSpace) {
-    //     LOG_DEBUG("VoxelBuffer", "Cannot allocate {} vertex regions (largest free block = {})",
-    //               vertexRegionsNeeded, get_largest_free_vertex_block());
-    // }
-    // if (!hasIndexSpace) {
-    //     LOG_DEBUG("VoxelBuffer", "Cannot allocate {} index regions (largest free block = {})",
-    //               indexRegionsNeeded, get_largest_free_index_block());
-    // }
+    auto culledIndirectDesc = nvrhi::BufferDesc()
+            .setByteSize(TERRAIN_CULLED_DRAWS_OFFSET + MAX_DRAW_SLOTS * sizeof(nvrhi::DrawIndexedIndirectArguments))
+            .setDebugName("VoxelBuffer Culled Indirect Buffer")
+            .setInitialState(nvrhi::ResourceStates::IndirectArgument)
+            .setIsDrawIndirectArgs(true)
+            .setCanHaveUAVs(true)
+            .setCanHaveRawViews(true)
+            .setKeepInitialState(true);
+    m_culledIndirectBuffer = m_backend->device->createBuffer(culledIndirectDesc);
 
-    return hasVertexSpace && hasIndexSpace;
+    init_quad_index_buffer();
 }
 
-bool VoxelBuffer::allocate_regions(std::vector<std::pair<uint32_t, uint32_t> > &freeList,
-                                   uint32_t regionCount, uint32_t &outStart) {
-    // Find first fit
-    for (auto it = freeList.begin(); it != freeList.end(); ++it) {
-        if (it->second >= regionCount) {
-            outStart = it->first;
-
-            // Reduce or remove this free block
-            if (it->second == regionCount) {
-                freeList.erase(it);
-            } else {
-                it->first += regionCount;
-                it->second -= regionCount;
-            }
-            return true;
-        }
+void VoxelBuffer::init_quad_index_buffer() {
+    std::vector<uint32_t> indices(static_cast<size_t>(MAX_FACES_PER_MESH) * INDICES_PER_FACE);
+    for (uint32_t face = 0; face < MAX_FACES_PER_MESH; face++) {
+        const uint32_t baseVertex = face * VERTICES_PER_FACE;
+        uint32_t* quad = &indices[static_cast<size_t>(face) * INDICES_PER_FACE];
+        quad[0] = baseVertex + 0;
+        quad[1] = baseVertex + 1;
+        quad[2] = baseVertex + 2;
+        quad[3] = baseVertex + 0;
+        quad[4] = baseVertex + 2;
+        quad[5] = baseVertex + 3;
     }
-    return false;
-}
 
-void VoxelBuffer::free_regions(std::vector<std::pair<uint32_t, uint32_t> > &freeList,
-                               uint32_t start, uint32_t count) {
-    if (count == 0) return;
-
-    uint32_t newStart = start;
-    uint32_t newEnd = start + count;
-
-    // Search for adjacent blocks to merge
-    for (auto it = freeList.begin(); it != freeList.end();) {
-        uint32_t blockStart = it->first;
-        uint32_t blockEnd = blockStart + it->second;
-
-        // If adjacent, merge
-        if (blockEnd == newStart) {
-            newStart = blockStart;
-            it = freeList.erase(it);
-        } else if (newEnd == blockStart) {
-            newEnd = blockEnd;
-            it = freeList.erase(it);
-        } else {
-            ++it;
-        }
-    }
+    auto quadIndexDesc = nvrhi::BufferDesc()
+            .setByteSize(indices.size() * sizeof(uint32_t))
+            .setDebugName("VoxelBuffer Quad Index Buffer")
+            .setIsIndexBuffer(true)
+            .setInitialState(nvrhi::ResourceStates::IndexBuffer)
+            .setKeepInitialState(true);
+    m_quadIndexBuffer = m_backend->device->createBuffer(quadIndexDesc);
+
+    // Never changes, written once on the graphics queue before the first frame uses it
+    nvrhi::CommandListHandle cmd = m_backend->device->createCommandList();
+    cmd->open();
+    cmd->writeBuffer(m_quadIndexBuffer, indices.data(), indices.size() * sizeof(uint32_t));
+    cmd->close();
+    m_backend->device->executeCommandList(cmd);
+}
 
-    freeList.emplace_back(newStart, newEnd - newStart);
+bool VoxelBuffer::can_allocate(uint32_t faceCount) {
+    uint32_t faceRegionsNeeded = (faceCount + FACES_PER_REGION - 1) / FACES_PER_REGION;
+    return m_faceAllocator.can_allocate(faceRegionsNeeded);
 }
 
-bool VoxelBuffer::allocate(VoxelChunkMesh &mesh) {
+bool VoxelBuffer::allocate_slot(uint64_t owner, uint32_t faceCount, uint32_t &outSlot) {
     /////// Allocate Mesh Regions ///////
-    uint32_t vertexRegionsNeeded = (mesh.vertexCount + VERTICES_PER_REGION - 1) / VERTICES_PER_REGION;
-    uint32_t indexRegionsNeeded = (mesh.indexCount + (INDEX_REGION_SIZE / INDEX_SIZE) - 1) / (
-                                      INDEX_REGION_SIZE / INDEX_SIZE);
-
-    uint32_t vertexStart, indexStart, indirectStart;
+    uint32_t faceRegionsNeeded = (faceCount + FACES_PER_REGION - 1) / FACES_PER_REGION;
 
-    if (!allocate_regions(m_freeVertexRegions, vertexRegionsNeeded, vertexStart)) {
+    uint32_t faceStart;
+    if (!m_faceAllocator.allocate(faceRegionsNeeded, faceStart)) {
         return false;
     }
 
-    if (!allocate_regions(m_freeIndexRegions, indexRegionsNeeded, indexStart)) {
-        // Rollback vertex allocation
-        free_regions(m_freeVertexRegions, vertexStart, vertexRegionsNeeded);
-        return false;
-    }
-
-    mesh.vertexRegionStart = vertexStart;
-    mesh.vertexRegionCount = vertexRegionsNeeded;
-    mesh.indexRegionStart = indexStart;
-    mesh.indexRegionCount = indexRegionsNeeded;
-
 
     /////// Allocate Indirect Draw Slot ///////
     uint32_t drawSlot;
@@ -167,49 +128,128 @@ bool VoxelBuffer::allocate(VoxelChunkMesh &mesh) {
         m_freeDrawSlots.pop_back();
     } else {
         drawSlot = m_nextDrawSlot++;
+
+        m_drawArgs.emplace_back();
+        m_boundsMinX.push_back(0.0f);
+        m_boundsMinY.push_back(0.0f);
+        m_boundsMinZ.push_back(0.0f);
+        m_boundsMaxX.push_back(0.0f);
+        m_boundsMaxY.push_back(0.0f);
+        m_boundsMaxZ.push_back(0.0f);
+        m_slotVisible.push_back(0);
+        m_slotRecords.emplace_back();
     }
 
+    m_slotRecords[drawSlot] = {
+        .owner = owner,
+        .faceRegionStart = faceStart,
+        .faceRegionCount = faceRegionsNeeded,
+        .faceCount = faceCount
+    };
+    outSlot = drawSlot;
+
+    return true;
+}
+
+bool VoxelBuffer::allocate(VoxelChunkMesh &mesh, uint64_t owner) {
+    uint32_t drawSlot;
+    if (!allocate_slot(owner, mesh.faceCount, drawSlot)) {
+        return false;
+    }
+
+    const DrawSlotRecord& record = m_slotRecords[drawSlot];
+    mesh.faceRegionStart = record.faceRegionStart;
+    mesh.faceRegionCount = record.faceRegionCount;
     mesh.drawSlotIndex = drawSlot;
 
     return true;
 }
 
-void VoxelBuffer::write(nvrhi::CommandListHandle cmd, VoxelChunkMesh &mesh, const TerrainOUB &oub) {
+uint64_t VoxelBuffer::write_mesh(nvrhi::CommandListHandle cmd, UploadContext &uploads, VoxelChunkMesh &mesh) {
     if (!mesh.is_allocated()) {
         LOG_ERROR("VoxelBuffer", "Cannot write unallocated mesh to buffer");
-        return;
+        return 0;
     }
 
-    cmd->setBufferState(m_meshBuffer, nvrhi::ResourceStates::CopyDest);
+    const uint64_t ticket = uploads.get_pending_ticket();
 
-    // Write vertices
-    uint64_t vertexByteOffset = mesh.vertexRegionStart * VERTEX_REGION_SIZE;
-    cmd->writeBuffer(m_meshBuffer, mesh.vertices.data(),
-                     sizeof(TerrainVertex3d) * mesh.vertexCount, vertexByteOffset);
+    // Write faces
+    uint64_t faceByteOffset = get_face_offset(mesh.faceRegionStart);
+    uint64_t faceBytes = sizeof(TerrainFace) * mesh.faceCount;
+    if (!uploads.stage_copy(m_meshBuffer, faceByteOffset, mesh.faces.data(), faceBytes)) {
+        upload(cmd, m_meshBuffer, mesh.faces.data(), faceBytes, faceByteOffset);
+        // written by the frame command list, usable by this frame
+        return 0;
+    }
+    m_slotRecords[mesh.drawSlotIndex].uploadTicket = ticket;
 
-    // Write indices
-    uint64_t indexByteOffset = mesh.indexRegionStart * INDEX_REGION_SIZE + INDEX_SECTION_OFFSET;
-    cmd->writeBuffer(m_meshBuffer, mesh.indices.data(),
-                     sizeof(uint32_t) * mesh.indexCount, indexByteOffset);
+    // a new slot was never written, disable its draw until the data is resident
+    write_draw_command(cmd, mesh.drawSlotIndex);
+    return ticket;
+}
 
-    cmd->setBufferState(m_meshBuffer, nvrhi::ResourceStates::VertexBuffer | nvrhi::ResourceStates::IndexBuffer);
+void VoxelBuffer::activate(nvrhi::CommandListHandle cmd, uint32_t slot, const TerrainOUB &oub, const ChunkAABB &bounds) {
+    m_slotRecords[slot].active = true;
 
     // Write OUB
-    uint64_t oubByteOffset = mesh.drawSlotIndex * sizeof(TerrainOUB);
-    cmd->writeBuffer(m_oubBuffer, &oub, sizeof(TerrainOUB), oubByteOffset);
+    uint64_t oubByteOffset = slot * sizeof(TerrainOUB);
+    upload(cmd, m_oubBuffer, &oub, sizeof(TerrainOUB), oubByteOffset);
 
-    // Write Indirect Args
+    write_draw_command(cmd, slot);
+    write_bounds(cmd, slot, bounds);
+}
+
+void VoxelBuffer::write_draw_command(nvrhi::CommandListHandle cmd, uint32_t slot) {
+    const DrawSlotRecord& record = m_slotRecords[slot];
+    if (!record.active) {
+        // disabled draw: indexCount = 0, skipped by the culling
+        auto args = nvrhi::DrawIndexedIndirectArguments().setIndexCount(0).setInstanceCount(0);
+        upload(cmd, m_indirectBuffer, &args, sizeof(nvrhi::DrawIndexedIndirectArguments),
+               slot * sizeof(nvrhi::DrawIndexedIndirectArguments));
+        m_drawArgs[slot] = args;
+        return;
+    }
+
+    // The quad index buffer is shared: the base vertex moves it to the faces of the slot, gl_VertexIndex / 4 is the face
+    // (a mesh can't have more faces than the quad index buffer covers)
+    const uint32_t faceCount = std::min(record.faceCount, MAX_FACES_PER_MESH);
     auto args = nvrhi::DrawIndexedIndirectArguments()
-            .setBaseVertexLocation(mesh.vertexRegionStart * VERTICES_PER_REGION)
-            .setIndexCount(mesh.indexCount)
-            .setStartIndexLocation(mesh.indexRegionStart * (INDEX_REGION_SIZE / INDEX_SIZE))
+            .setBaseVertexLocation(static_cast<int32_t>(record.faceRegionStart * FACES_PER_REGION * VERTICES_PER_FACE))
+            .setIndexCount(faceCount * INDICES_PER_FACE)
+            .setStartIndexLocation(0)
             .setInstanceCount(1)
-            .setStartInstanceLocation(mesh.drawSlotIndex); // Use firstInstance as draw ID for gl_BaseInstance
-    uint64_t indirectByteOffset = mesh.drawSlotIndex * sizeof(nvrhi::DrawIndexedIndirectArguments);
-    cmd->writeBuffer(m_indirectBuffer, &args, sizeof(nvrhi::DrawIndexedIndirectArguments), indirectByteOffset);
+            .setStartInstanceLocation(slot); // Use firstInstance as draw ID for gl_BaseInstance
+    uint64_t indirectByteOffset = slot * sizeof(nvrhi::DrawIndexedIndirectArguments);
+    upload(cmd, m_indirectBuffer, &args, sizeof(nvrhi::DrawIndexedIndirectArguments), indirectByteOffset);
 
-    // float avgVertexToIndexRatio = ((float)mesh.vertexCount / mesh.indexCount);
-    // LOG_INFO("VoxelBuffer", "Vertex/Index ratio: {:.2f}", avgVertexToIndexRatio);
+    m_drawArgs[slot] = args;
+}
+
+void VoxelBuffer::write_bounds(nvrhi::CommandListHandle cmd, uint32_t slot, const ChunkAABB &bounds) {
+    const TerrainCullBounds gpuBounds = {
+        .min = glm::vec4(bounds.min, 0.0f),
+        .max = glm::vec4(bounds.max, 0.0f)
+    };
+    upload(cmd, m_boundsBuffer, &gpuBounds, sizeof(TerrainCullBounds), slot * sizeof(TerrainCullBounds));
+
+    m_boundsMinX[slot] = bounds.min.x;
+    m_boundsMinY[slot] = bounds.min.y;
+    m_boundsMinZ[slot] = bounds.min.z;
+    m_boundsMaxX[slot] = bounds.max.x;
+    m_boundsMaxY[slot] = bounds.max.y;
+    m_boundsMaxZ[slot] = bounds.max.z;
+}
+
+void VoxelBuffer::upload(nvrhi::CommandListHandle cmd, nvrhi::IBuffer *buffer, const void *data, uint64_t size, uint64_t offset) {
+    if (m_stagingRing && m_stagingRing->stage_copy(buffer, offset, data, size)) {
+        return;
+    }
+    // Ring full, the data is copied right away by NVRHI's upload manager.
+    // The staged copies are recorded first, they may target the same bytes and must not land after this write.
+    if (m_stagingRing) {
+        m_stagingRing->flush(cmd);
+    }
+    cmd->writeBuffer(buffer, data, size, offset);
 }
 
 void VoxelBuffer::cleanup_freed_draw_slots(nvrhi::CommandListHandle cmd) {
@@ -226,55 +266,157 @@ void VoxelBuffer::cleanup_freed_draw_slots(nvrhi::CommandListHandle cmd) {
     m_freedPendingDrawSlots.clear();
 }
 
-void VoxelBuffer::free(VoxelChunkMesh &mesh) {
-    if (!mesh.is_allocated()) {
-        return;
+void VoxelBuffer::retire_freed_draw_slots(uint64_t completedFrameNumber, const UploadContext &uploads) {
+    size_t kept = 0;
+    for (const RetiredDrawSlot &retired : m_retiredDrawSlots) {
+        // the draw is disabled by cleanup_freed_draw_slots in the frame it was freed, so once that frame is done
+        // nothing reads the slot anymore
+        if (retired.frameNumber > completedFrameNumber || !uploads.is_complete(retired.uploadTicket)) {
+            m_retiredDrawSlots[kept++] = retired;
+            continue;
+        }
+
+        const DrawSlotRecord &record = m_slotRecords[retired.slot];
+        m_faceAllocator.free(record.faceRegionStart, record.faceRegionCount);
+        m_slotRecords[retired.slot] = {};
+        m_freeDrawSlots.push_back(retired.slot);
     }
+    m_retiredDrawSlots.resize(kept);
+}
 
-    free_regions(m_freeVertexRegions, mesh.vertexRegionStart, mesh.vertexRegionCount);
-    free_regions(m_freeIndexRegions, mesh.indexRegionStart, mesh.indexRegionCount);
+uint32_t VoxelBuffer::cull_draws(nvrhi::CommandListHandle cmd, const Frustum &frustum) {
+    const size_t slotCount = m_drawArgs.size();
+    if (slotCount == 0) return 0;
 
-    m_freeDrawSlots.push_back(mesh.drawSlotIndex);
-    m_freedPendingDrawSlots.push_back(mesh.drawSlotIndex); // Mark for cleanup after GPU is done
+    uint8_t* visible = m_slotVisible.data();
+    std::fill(m_slotVisible.begin(), m_slotVisible.end(), 1);
 
-    mesh.vertexRegionStart = UINT32_MAX;
-    mesh.vertexRegionCount = 0;
-    mesh.indexRegionStart = UINT32_MAX;
-    mesh.indexRegionCount = 0;
-}
+    // A box is outside when its corner the furthest along the plane normal is behind the plane.
+    // Picking that corner per plane (instead of per slot) leaves a branchless loop the compiler vectorizes.
+    for (const glm::vec4 &plane : frustum.planes) {
+        const float* x = plane.x >= 0.0f ? m_boundsMaxX.data() : m_boundsMinX.data();
+        const float* y = plane.y >= 0.0f ? m_boundsMaxY.data() : m_boundsMinY.data();
+        const float* z = plane.z >= 0.0f ? m_boundsMaxZ.data() : m_boundsMinZ.data();
 
-uint32_t VoxelBuffer::get_used_vertex_regions() const {
-    uint32_t totalFree = 0;
-    for (const auto &[start, count]: m_freeVertexRegions) {
-        totalFree += count;
+        for (size_t i = 0; i < slotCount; i++) {
+            const float distance = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w;
+            visible[i] &= static_cast<uint8_t>(distance >= 0.0f);
+        }
     }
-    return MAX_VERTEX_REGION - totalFree;
+
+    m_visibleDrawArgs.clear();
+    for (size_t i = 0; i < slotCount; i++) {
+        if (visible[i] && m_drawArgs[i].indexCount > 0) {
+            m_visibleDrawArgs.push_back(m_drawArgs[i]);
+        }
+    }
+
+    const auto visibleCount = static_cast<uint32_t>(m_visibleDrawArgs.size());
+    if (visibleCount > 0) {
+        cmd->writeBuffer(m_visibleIndirectBuffer, m_visibleDrawArgs.data(),
+                         visibleCount * sizeof(nvrhi::DrawIndexedIndirectArguments), 0);
+    }
+    return visibleCount;
+}
+
+void VoxelBuffer::release_slot(uint32_t slot) {
+    DrawSlotRecord& record = m_slotRecords[slot];
+
+    m_freedPendingDrawSlots.push_back(slot); // Mark for cleanup, the draw is disabled this frame
+    m_retiredDrawSlots.push_back({
+        .slot = slot,
+        .frameNumber = m_backend->get_frame_number(),
+        .uploadTicket = record.uploadTicket
+    });
+    m_drawArgs[slot] = nvrhi::DrawIndexedIndirectArguments(); // indexCount = 0, skipped by the culling
+
+    // the regions stay allocated until retire_freed_draw_slots, the slot is not relocated anymore
+    record.owner = 0;
+    record.active = false;
 }
 
-uint32_t VoxelBuffer::get_used_index_regions() const {
-    uint32_t totalFree = 0;
-    for (const auto &[start, count]: m_freeIndexRegions) {
-        totalFree += count;
+void VoxelBuffer::free(VoxelChunkMesh &mesh) {
+    if (!mesh.is_allocated()) {
+        return;
     }
-    return MAX_INDEX_REGION - totalFree;
+
+    release_slot(mesh.drawSlotIndex);
+
+    mesh.faceRegionStart = UINT32_MAX;
+    mesh.faceRegionCount = 0;
 }
 
-uint32_t VoxelBuffer::get_largest_free_vertex_block() const {
-    uint32_t largest = 0;
-    for (const auto &[start, count]: m_freeVertexRegions) {
-        if (count > largest) {
-            largest = count;
-        }
+uint64_t VoxelBuffer::relocate(nvrhi::CommandListHandle cmd, uint32_t slot, VoxelBuffer &destination,
+                               MeshRelocation &outRelocation) {
+    // copied, the record can move when the destination is this buffer and grows its slots
+    const DrawSlotRecord record = m_slotRecords[slot];
+    // unused, detached, or its data is still being uploaded
+    if (record.owner == 0 || !record.active) return 0;
+
+    uint32_t newSlot;
+    if (!destination.allocate_slot(record.owner, record.faceCount, newSlot)) {
+        return 0;
     }
-    return largest;
+    DrawSlotRecord& newRecord = destination.m_slotRecords[newSlot];
+    newRecord.active = true;
+
+    const uint64_t faceBytes = static_cast<uint64_t>(record.faceCount) * FACE_SIZE;
+
+    // The source and destination can be the same buffer (the ranges never overlap, the old ones are still allocated),
+    // so the barriers are set by hand for a buffer being read and written by the copies
+    constexpr auto copyState = nvrhi::ResourceStates::CopySource | nvrhi::ResourceStates::CopyDest;
+    cmd->setBufferState(m_meshBuffer, copyState);
+    cmd->setBufferState(destination.m_meshBuffer, copyState);
+    cmd->setBufferState(m_oubBuffer, copyState);
+    cmd->setBufferState(destination.m_oubBuffer, copyState);
+    cmd->commitBarriers();
+    cmd->setEnableAutomaticBarriers(false);
+
+    cmd->copyBuffer(destination.m_meshBuffer, destination.get_face_offset(newRecord.faceRegionStart),
+                    m_meshBuffer, get_face_offset(record.faceRegionStart), faceBytes);
+    cmd->copyBuffer(destination.m_oubBuffer, newSlot * sizeof(TerrainOUB),
+                    m_oubBuffer, slot * sizeof(TerrainOUB), sizeof(TerrainOUB));
+
+    cmd->setEnableAutomaticBarriers(true);
+    cmd->setBufferState(m_meshBuffer, nvrhi::ResourceStates::ShaderResource);
+    cmd->setBufferState(destination.m_meshBuffer, nvrhi::ResourceStates::ShaderResource);
+    cmd->setBufferState(m_oubBuffer, nvrhi::ResourceStates::ShaderResource);
+    cmd->setBufferState(destination.m_oubBuffer, nvrhi::ResourceStates::ShaderResource);
+
+    destination.write_draw_command(cmd, newSlot);
+    destination.write_bounds(cmd, newSlot, ChunkAABB{
+        .min = glm::vec3(m_boundsMinX[slot], m_boundsMinY[slot], m_boundsMinZ[slot]),
+        .max = glm::vec3(m_boundsMaxX[slot], m_boundsMaxY[slot], m_boundsMaxZ[slot])
+    });
+
+    outRelocation = {
+        .owner = record.owner,
+        .drawSlotIndex = newSlot,
+        .faceRegionStart = newRecord.faceRegionStart,
+        .faceRegionCount = newRecord.faceRegionCount
+    };
+
+    release_slot(slot);
+
+    return faceBytes + sizeof(TerrainOUB);
 }
 
-uint32_t VoxelBuffer::get_largest_free_index_block() const {
-    uint32_t largest = 0;
-    for (const auto &[start, count]: m_freeIndexRegions) {
-        if (count > largest) {
-            largest = count;
+bool VoxelBuffer::find_compaction_candidate(uint32_t maxScannedSlots, uint32_t &outSlot) {
+    const auto slotCount = static_cast<uint32_t>(m_slotRecords.size());
+    if (slotCount == 0) return false;
+
+    const uint32_t scanned = std::min(maxScannedSlots, slotCount);
+    for (uint32_t i = 0; i < scanned; i++) {
+        const uint32_t slot = m_compactionCursor;
+        m_compactionCursor = (m_compactionCursor + 1) % slotCount;
+
+        const DrawSlotRecord& record = m_slotRecords[slot];
+        if (record.owner == 0 || !record.active) continue;
+
+        if (m_faceAllocator.is_between_free_blocks(record.faceRegionStart, record.faceRegionCount)) {
+            outSlot = slot;
+            return true;
         }
     }
-    return largest;
+    return false;
 }
@@ -1,12 +1,18 @@
 #pragma once
 
 #include "nvrhi/nvrhi.h"
+#include "Frustum.h"
+#include "RegionAllocator.h"
+#include "core/world/world_components.h"
 #include "renderer/render_types.h"
+#include "renderer/vulkan/StagingRingBuffer.h"
+#include "renderer/vulkan/UploadContext.h"
 #include "renderer/vulkan/VulkanBackend.h"
 
 
+// Per-draw data, the vertex shader places the chunk relative to the camera from its coordinate
 struct alignas(16) TerrainOUB {
-    glm::mat4 model; // Model matrice
+    glm::ivec4 chunkCoord; // xyz: chunk coordinate, w: unused
 };
 
 // Represent a draw to do
@@ -15,104 +21,185 @@ struct ChunkDrawData {
     TerrainOUB oubData;
 };
 
-static constexpr uint64_t TOTAL_BUFFER_SIZE = 64 * 1024 * 1024; // 64 MB
-
-static constexpr uint32_t VERTEX_SIZE = sizeof(TerrainVertex3d);
-static constexpr uint32_t INDEX_SIZE = sizeof(uint32_t);
+// World space box containing a chunk mesh, used to frustum cull its draw
+struct ChunkAABB {
+    glm::vec3 min;
+    glm::vec3 max;
+};
 
-static constexpr float INDEX_TO_VERTEX_RATIO = 5.0f;
+// Bounds of a draw slot as read by the GPU culling shader (TerrainCullChunks.comp)
+struct alignas(16) TerrainCullBounds {
+    glm::vec4 min;
+    glm::vec4 max;
+};
 
-static constexpr uint32_t VERTICES_PER_REGION = 300;
-static constexpr uint32_t VERTEX_REGION_SIZE = VERTICES_PER_REGION * VERTEX_SIZE;
-static constexpr uint32_t INDICES_PER_VERTEX_REGION = static_cast<uint32_t>(VERTICES_PER_REGION * INDEX_TO_VERTEX_RATIO);
-static constexpr uint32_t INDEX_REGION_SIZE = ((INDICES_PER_VERTEX_REGION * INDEX_SIZE + 1023) / 1024) * 1024;
+// Where the mesh of a draw slot lives, kept by the buffer so meshes can be moved without looking at their entity
+struct DrawSlotRecord {
+    uint64_t owner = 0; // entity of the mesh, 0 for an unused slot
+    uint32_t faceRegionStart = UINT32_MAX;
+    uint32_t faceRegionCount = 0;
+    uint32_t faceCount = 0;
+    bool active = false; // the mesh data is resident and the draw command written, see VoxelBuffer::activate
+    uint64_t uploadTicket = 0; // UploadContext ticket writing the mesh data, 0 if written by a frame
+};
 
-// static constexpr float VERTEX_TO_INDEX_BYTE_RATIO = 0.67f;
-static constexpr float VERTEX_TO_INDEX_BYTE_RATIO = 1.0f;
+// Draw slot freed by the CPU, its regions and the slot are reused once the GPU can't touch them anymore
+struct RetiredDrawSlot {
+    uint32_t slot;
+    uint64_t frameNumber;  // last frame that may read the mesh (see VulkanBackend::get_completed_frame_number)
+    uint64_t uploadTicket; // upload that may still write the mesh
+};
 
-static constexpr float VERTEX_FRACTION = VERTEX_TO_INDEX_BYTE_RATIO / (VERTEX_TO_INDEX_BYTE_RATIO + 1.0f);
-static constexpr float INDEX_FRACTION = 1.0f - VERTEX_FRACTION;
+// New location of a mesh moved by VoxelBuffer::relocate, to patch its VoxelChunkMesh
+struct MeshRelocation {
+    uint64_t owner;
+    uint32_t drawSlotIndex;
+    uint32_t faceRegionStart;
+    uint32_t faceRegionCount;
+};
 
-static constexpr uint64_t VERTEX_SECTION_SIZE = ((static_cast<uint64_t>(TOTAL_BUFFER_SIZE * VERTEX_FRACTION) + 63) / 64) * 64;
-static constexpr uint64_t INDEX_SECTION_SIZE = TOTAL_BUFFER_SIZE - VERTEX_SECTION_SIZE;
+static constexpr uint32_t MAX_DRAW_SLOTS = 128 * 1024;
 
-static constexpr uint64_t VERTEX_SECTION_OFFSET = 0;
-static constexpr uint64_t INDEX_SECTION_OFFSET = VERTEX_SECTION_SIZE;
+// The GPU culled indirect buffer starts with the draw count, the draws follow at this offset
+static constexpr uint64_t TERRAIN_CULLED_DRAWS_OFFSET = 16;
 
-static constexpr uint32_t MAX_VERTEX_REGION = VERTEX_SECTION_SIZE / VERTEX_REGION_SIZE;
-static constexpr uint32_t MAX_INDEX_REGION = INDEX_SECTION_SIZE / INDEX_REGION_SIZE;
+// Every chunk mesh of the terrain is sub-allocated in one buffer of this size, drawn with a single multi-draw
+static constexpr uint64_t TOTAL_BUFFER_SIZE = 64 * 1024 * 1024; // 64 MB, 8M faces
 
-static_assert(VERTEX_SECTION_SIZE + INDEX_SECTION_SIZE == TOTAL_BUFFER_SIZE,
-              "Sections must sum to total buffer size");
-static_assert(INDEX_SECTION_OFFSET % 4 == 0,
-              "Index offset MUST be aligned to 4 bytes for VK_INDEX_TYPE_UINT32");
-static_assert(INDEX_SECTION_OFFSET % 64 == 0,
-              "Index offset should be aligned to 64 bytes for cache efficiency");
-static_assert(VERTEX_SECTION_SIZE % 64 == 0,
-              "Vertex section should be aligned to 64 bytes");
-static_assert(INDEX_SECTION_SIZE % 64 == 0,
-              "Index section should be aligned to 64 bytes");
+static constexpr uint32_t FACE_SIZE = sizeof(TerrainFace);
 
+static constexpr uint32_t FACES_PER_REGION = 64;
+static constexpr uint32_t FACE_REGION_SIZE = FACES_PER_REGION * FACE_SIZE;
+static constexpr uint32_t MAX_FACE_REGION = TOTAL_BUFFER_SIZE / FACE_REGION_SIZE;
 
+// Each face is drawn as two triangles of its 4 corners, vertex = face * 4 + corner
+static constexpr uint32_t VERTICES_PER_FACE = 4;
+static constexpr uint32_t INDICES_PER_FACE = 6;
+// Most faces a chunk can have (every other voxel solid), size of the shared quad index buffer
+static constexpr uint32_t MAX_FACES_PER_MESH = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE / 2 * 6;
 
+static_assert(TOTAL_BUFFER_SIZE % FACE_REGION_SIZE == 0,
+              "The buffer must hold a whole number of face regions");
+static_assert(static_cast<uint64_t>(MAX_FACE_REGION) * FACES_PER_REGION * VERTICES_PER_FACE <= INT32_MAX,
+              "The base vertex of the draws must fit in an int32");
 
 
 // This class represent a buffer that can hold multiple voxel chunks in GPU memory in a limit of TOTAL_BUFFER_SIZE
+// The terrain renderer uses a single one as its mesh arena, so all the chunks share the same bindings
 class VoxelBuffer {
     VulkanBackend* m_backend;
+    StagingRingBuffer* m_stagingRing; // owned by the renderer, flushed once per frame
 
-    // Single 64 MB buffer with all three usage flags
+    // Faces of every mesh, read by the vertex shader as a structured buffer
     nvrhi::BufferHandle m_meshBuffer;
+    // Index pattern of the quads (0, 1, 2, 0, 2, 3 per face), shared by every draw
+    nvrhi::BufferHandle m_quadIndexBuffer;
 
     // Small buffer for indirect draw commands and OUB data
     nvrhi::BufferHandle m_oubBuffer;
     nvrhi::BufferHandle m_indirectBuffer;
+    // Draw commands of the visible chunks only, rebuilt every frame from the CPU copy below
+    nvrhi::BufferHandle m_visibleIndirectBuffer;
+    // Bounds of each draw slot and draw commands written by the GPU culling ([count | draws])
+    nvrhi::BufferHandle m_boundsBuffer;
+    nvrhi::BufferHandle m_culledIndirectBuffer;
     // Management of those buffers
     std::vector<uint32_t> m_freeDrawSlots;
     uint32_t m_nextDrawSlot = 0;
 
-    // Separate free lists for each section (start region, count)
-    std::vector<std::pair<uint32_t, uint32_t>> m_freeVertexRegions;
-    std::vector<std::pair<uint32_t, uint32_t>> m_freeIndexRegions;
+    // Allocator of the mesh buffer, in face regions
+    RegionAllocator m_faceAllocator;
 
     // List of freed draw slot to desactivate to be sure that he doesnt draw
     std::vector<uint32_t> m_freedPendingDrawSlots;
+    // Freed draw slots waiting for the GPU, their regions are still allocated
+    std::vector<RetiredDrawSlot> m_retiredDrawSlots;
+
+    // CPU copy of the draw commands, indexed by draw slot (indexCount = 0 for unused slots)
+    std::vector<nvrhi::DrawIndexedIndirectArguments> m_drawArgs;
+    // Bounds of each draw slot as separate arrays, so the frustum test runs on several slots at once
+    std::vector<float> m_boundsMinX, m_boundsMinY, m_boundsMinZ;
+    std::vector<float> m_boundsMaxX, m_boundsMaxY, m_boundsMaxZ;
+    std::vector<uint8_t> m_slotVisible;
+    std::vector<nvrhi::DrawIndexedIndirectArguments> m_visibleDrawArgs;
+
+    std::vector<DrawSlotRecord> m_slotRecords;
+    uint32_t m_compactionCursor = 0; // next slot looked at by find_compaction_candidate
 
     void init();
+    void init_quad_index_buffer();
 
-    // Helper methods for region management
-    bool allocate_regions(std::vector<std::pair<uint32_t, uint32_t>>& freeList,
-                        uint32_t regionCount, uint32_t& outStart);
-    void free_regions(std::vector<std::pair<uint32_t, uint32_t>>& freeList,
-                    uint32_t start, uint32_t count);
+    /**
+     * Allocate the regions and a draw slot for a mesh, and fill its slot record
+     * @return True if allocation succeeded, false otherwise
+     */
+    bool allocate_slot(uint64_t owner, uint32_t faceCount, uint32_t& outSlot);
+
+    /**
+     * Write the draw command of a slot from its record, in the indirect buffer and its CPU copy
+     */
+    void write_draw_command(nvrhi::CommandListHandle cmd, uint32_t slot);
+    void write_bounds(nvrhi::CommandListHandle cmd, uint32_t slot, const ChunkAABB& bounds);
+    void release_slot(uint32_t slot);
+
+    /**
+     * Upload data through the staging ring, or with writeBuffer if the ring is full
+     */
+    void upload(nvrhi::CommandListHandle cmd, nvrhi::IBuffer* buffer, const void* data, uint64_t size, uint64_t offset);
 
 public:
-    VoxelBuffer(VulkanBackend* backend);
+    VoxelBuffer(VulkanBackend* backend, StagingRingBuffer* stagingRing);
     ~VoxelBuffer();
 
     /**
      * Test if allocation is possible for the given mesh data
-     * @param vertexCount The count of vertices to allocate
-     * @param indexCount The count of indices to allocate
+     * @param faceCount The count of faces to allocate
      * @return True if allocation is possible, false otherwise
      */
-    bool can_allocate(uint32_t vertexCount, uint32_t indexCount);
+    bool can_allocate(uint32_t faceCount);
 
     /**
      * Allocate space in the buffer for a chunk mesh
      * Updates the VoxelChunkMesh component with allocation info
      * @param mesh VoxelChunkMesh component to fill with allocation data
+     * @param owner Entity of the mesh, reported when the mesh is relocated
      * @return True if allocation succeeded, false otherwise
      */
-    bool allocate(struct VoxelChunkMesh& mesh);
+    bool allocate(struct VoxelChunkMesh& mesh, uint64_t owner);
 
     /**
-     * Write data of an already allocated mesh to the buffer.
+     * Write the faces of an already allocated mesh to the buffer, through the upload context.
+     * The draw slot stays disabled until activate() is called.
      * Warning: it will not check if allocate in this buffer or not
+     * @param cmd Frame command list, used when the upload context is full
+     * @param uploads Upload context receiving the copies
      * @param mesh Allocated mesh data to write in the buffer
+     * @return Ticket of the upload context to wait for before activating the slot, 0 if it can be activated now
+     */
+    uint64_t write_mesh(nvrhi::CommandListHandle cmd, UploadContext& uploads, struct VoxelChunkMesh& mesh);
+
+    /**
+     * Enable the draw of a slot whose mesh data is resident, writes its draw command, OUB and bounds
      * @param oub
+     * @param bounds World space bounds of the mesh, used for the frustum culling
+     */
+    void activate(nvrhi::CommandListHandle cmd, uint32_t slot, const TerrainOUB &oub, const ChunkAABB &bounds);
+
+    /**
+     * Forget the owner of a slot, it keeps being drawn but is not moved by the defragmentation anymore.
+     * Used to draw the previous mesh of a chunk until its new mesh is uploaded, then released with free_slot().
+     */
+    void detach(uint32_t slot) { m_slotRecords[slot].owner = 0; }
+    void free_slot(uint32_t slot) { release_slot(slot); }
+
+    /**
+     * Test every draw slot against the frustum and write the draw commands of the visible ones,
+     * packed at the start of the visible indirect buffer.
+     * @param cmd Command list to record the write
+     * @param frustum Camera frustum in world space
+     * @return Number of visible draws to submit from the visible indirect buffer
      */
-    void write(nvrhi::CommandListHandle cmd, struct VoxelChunkMesh& mesh, const TerrainOUB &oub);
+    uint32_t cull_draws(nvrhi::CommandListHandle cmd, const Frustum &frustum);
 
     /**
      * List of freed draw slots to reset the draw command to be sure they are not drawn anymore
@@ -121,6 +208,14 @@ public:
      */
     void cleanup_freed_draw_slots(nvrhi::CommandListHandle cmd);
 
+    /**
+     * Give back to the allocators the regions and draw slots freed before the last completed frame,
+     * once their upload (if any) is complete too. Until then a new mesh can't overwrite memory the GPU still uses.
+     * @param completedFrameNumber Last frame finished by the GPU
+     * @param uploads Upload context writing the mesh data
+     */
+    void retire_freed_draw_slots(uint64_t completedFrameNumber, const UploadContext& uploads);
+
     /**
      * Free a previously allocated chunk
      * @param mesh The VoxelChunkMesh component with allocation data
@@ -128,37 +223,66 @@ public:
     void free(struct VoxelChunkMesh& mesh);
 
     /**
-     * Get byte offset for a vertex region
+     * Move the mesh of a draw slot into the destination buffer (can be this buffer) with GPU copies.
+     * The old regions and draw slot are freed, the owner VoxelChunkMesh must be patched with the relocation.
+     * @param cmd Command list to record the copies
+     * @param slot Draw slot of the mesh to move
+     * @param destination Buffer receiving the mesh
+     * @param outRelocation New location of the mesh in the destination
+     * @return Number of bytes copied, 0 if the mesh couldn't be moved
      */
-    uint64_t get_vertex_offset(uint32_t regionStart) const {
-        return VERTEX_SECTION_OFFSET + (regionStart * VERTEX_REGION_SIZE);
-    }
+    uint64_t relocate(nvrhi::CommandListHandle cmd, uint32_t slot, VoxelBuffer& destination, MeshRelocation& outRelocation);
 
     /**
-     * Get byte offset for an index region
+     * Look for a mesh whose face block sits between two free blocks, moving it merges them.
+     * Resumes where the previous call stopped.
+     * @param maxScannedSlots Number of slots to look at
+     * @param outSlot Draw slot of the found mesh
+     * @return True if a mesh was found
      */
-    uint64_t get_index_offset(uint32_t regionStart) const {
-        return INDEX_SECTION_OFFSET + (regionStart * INDEX_REGION_SIZE);
+    bool find_compaction_candidate(uint32_t maxScannedSlots, uint32_t& outSlot);
+
+    /**
+     * Test if no mesh is allocated in this buffer anymore
+     */
+    bool is_empty() const { return m_faceAllocator.get_stats().allocationCount == 0; }
+
+    const DrawSlotRecord& get_slot_record(uint32_t slot) const { return m_slotRecords[slot]; }
+
+    /**
+     * Get byte offset for a face region
+     */
+    uint64_t get_face_offset(uint32_t regionStart) const {
+        return static_cast<uint64_t>(regionStart) * FACE_REGION_SIZE;
     }
 
     nvrhi::BufferHandle get_mesh_buffer() const { return m_meshBuffer; }
+    nvrhi::BufferHandle get_quad_index_buffer() const { return m_quadIndexBuffer; }
     nvrhi::BufferHandle get_oub_buffer() const { return m_oubBuffer; }
     nvrhi::BufferHandle get_indirect_buffer() const { return m_indirectBuffer; }
+    nvrhi::BufferHandle get_visible_indirect_buffer() const { return m_visibleIndirectBuffer; }
+    nvrhi::BufferHandle get_bounds_buffer() const { return m_boundsBuffer; }
+    nvrhi::BufferHandle get_culled_indirect_buffer() const { return m_culledIndirectBuffer; }
 
-    const std::vector<std::pair<uint32_t, uint32_t>>& get_free_vertex_regions() const { return m_freeVertexRegions; }
-    const std::vector<std::pair<uint32_t, uint32_t>>& get_free_index_regions() const { return m_freeIndexRegions; }
+    const RegionAllocator& get_face_allocator() const { return m_faceAllocator; }
 
     const std::vector <uint32_t>& get_free_draw_slots() const { return m_freeDrawSlots; }
+    size_t get_retired_draw_slot_count() const { return m_retiredDrawSlots.size(); }
 
-    uint32_t get_used_vertex_regions() const;
-    uint32_t get_used_index_regions() const;
-
-    uint32_t get_largest_free_vertex_block() const;
-    uint32_t get_largest_free_index_block() const;
+    uint32_t get_used_face_regions() const { return m_faceAllocator.get_stats().usedRegions; }
+    uint32_t get_largest_free_face_block() const { return m_faceAllocator.get_largest_free_block(); }
 
     /**
      * Return the number of registered draw commands in this buffer
      * @return Number of draw commands
      */
-    uint32_t get_draw_count() const { return m_nextDrawSlot - static_cast<uint32_t>(m_freeDrawSlots.size()); }
+    uint32_t get_draw_count() const {
+        return m_nextDrawSlot - static_cast<uint32_t>(m_freeDrawSlots.size() + m_retiredDrawSlots.size());
+    }
+
+    /**
+     * Return the number of draw slots to submit in the indirect draw (freed slots in between are disabled draws)
+     * @return Highest used draw slot + 1
+     */
+    uint32_t get_draw_slot_count() const { return m_nextDrawSlot; }
 };
\ No newline at end of file
@@ -1,70 +1,122 @@
 #include "VoxelChunkMesher.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
 #include "VoxelTextureManager.h"
 #include "core/log/Logger.h"
+#include "core/task/FrameBudget.h"
+#include "core/task/TaskScheduler.h"
+#include "core/world/ChunkManager.h"
 #include "renderer/rendering_components.h"
 
+namespace {
+    const glm::ivec3 FACE_DIRECTIONS[6] = {
+        {-1, 0, 0}, {1, 0, 0},
+        {0, -1, 0}, {0, 1, 0},
+        {0, 0, -1}, {0, 0, 1}
+    };
 
-VoxelChunkMesher::~VoxelChunkMesher() {
-    shutdown();
-}
+    int voxel_index(const glm::ivec3& pos) {
+        return pos.x + pos.y * CHUNK_SIZE + pos.z * CHUNK_SIZE * CHUNK_SIZE;
+    }
 
-void VoxelChunkMesher::shutdown() {
-    {
-        std::lock_guard<std::mutex> lock(m_taskMutex);
-        m_stop = true;
+    /**
+     * Position of the voxel at `depth` in the column `column` of the masks of `axis` (see FaceMasks)
+     */
+    glm::ivec3 column_voxel(int axis, int column, int depth) {
+        glm::ivec3 pos;
+        pos[axis] = depth;
+        pos[(axis + 1) % 3] = column % CHUNK_SIZE;
+        pos[(axis + 2) % 3] = column / CHUNK_SIZE;
+        return pos;
+    }
+
+    /**
+     * One bit per non-zero byte of `word`, bit i for the byte i (little endian)
+     */
+    uint32_t nonzero_bytes_mask(uint64_t word) {
+        constexpr uint64_t LOW_7_BITS = 0x7F7F7F7F7F7F7F7Full;
+        // high bit of each byte set if the byte is non-zero
+        const uint64_t highBits = (((word & LOW_7_BITS) + LOW_7_BITS) | word) & ~LOW_7_BITS;
+        // gather the 8 high bits in the top byte
+        return static_cast<uint32_t>(((highBits >> 7) * 0x0102040810204080ull) >> 56);
     }
-    m_taskCv.notify_all();
 
-    LOG_DEBUG("VoxelChunkMesher", "Shutting down {} worker threads", m_workerThreads.size());
-    for (auto& thread : m_workerThreads) {
-        if (thread.joinable()) {
-            thread.join();
+    /**
+     * In place transpose of a 32x32 bit matrix: bit c of row r is swapped with bit r of row c
+     */
+    void transpose_32x32(uint32_t* rows) {
+        uint32_t mask = 0x0000FFFFu;
+        for (int width = 16; width != 0; width >>= 1, mask ^= mask << width) {
+            for (int k = 0; k < 32; k = ((k | width) + 1) & ~width) {
+                const uint32_t swap = ((rows[k] >> width) ^ rows[k | width]) & mask;
+                rows[k] ^= swap << width;
+                rows[k | width] ^= swap;
+            }
         }
     }
-    m_workerThreads.clear();
-    LOG_INFO("VoxelChunkMesher", "All worker threads shut down");
-}
 
-void VoxelChunkMesher::enqueue(TaskMeshingInput &&taskInput) {
-    if (is_pending(taskInput.chunkCoord)) {
-        // already pending
-        return;
+    /**
+     * Texture rotation of a single voxel face, picked per voxel to break the tiling pattern
+     */
+    uint32_t face_uv_rotation(const glm::ivec3& pos) {
+        const uint32_t hash = (pos.x * 73856093u) ^ (pos.y * 19349663u) ^ (pos.z * 83492791u);
+        return hash % 4;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_taskMutex);
-        m_pendingCoords.insert(taskInput.chunkCoord);
-        m_taskQueue.push(std::move(taskInput));
+    /**
+     * Append a face covering width x height voxels from `origin`, along the face plane axes (see TerrainFace)
+     */
+    void push_face(TaskMeshingOutput& result, int face, const glm::ivec3& origin, int width, int height,
+                   uint32_t textureSlot, uint32_t uvRotation) {
+        TerrainFace record;
+        record.x = origin.x;
+        record.y = origin.y;
+        record.z = origin.z;
+        record.width = width - 1;
+        record.height = height - 1;
+        record.faceIndex = face;
+        record.uvRotation = uvRotation;
+        record.textureSlot = textureSlot;
+        result.faces.push_back(record);
     }
-    m_taskCv.notify_one();
 }
 
-std::vector<TaskMeshingOutput> VoxelChunkMesher::poll_results(size_t maxResults) {
-    std::vector<TaskMeshingOutput> results = {};
-    results.reserve(maxResults);
 
-    std::lock_guard<std::mutex> lock(m_taskMutex);
-    while (!m_resultQueue.empty() && results.size() < maxResults) {
-        TaskMeshingOutput output = std::move(m_resultQueue.front());
-        m_resultQueue.pop();
-        m_pendingCoords.erase(output.chunkCoord);
-        results.push_back(std::move(output));
-    }
+VoxelChunkMesher::~VoxelChunkMesher() {
+    shutdown();
+}
+
+void VoxelChunkMesher::shutdown() {
+    m_stop = true;
+}
 
-    return results;
+void VoxelChunkMesher::enqueue(TaskMeshingInput &&taskInput, TaskPriority priority) {
+    m_queuedTasks.fetch_add(1, std::memory_order_relaxed);
+    m_scheduler->submit([this, input = std::move(taskInput)] {
+        run_meshing_task(input);
+    }, priority);
 }
 
 void VoxelChunkMesher::init(flecs::world &ecs) {
     ecs.component<VoxelChunkMeshState>()
         .add(flecs::Exclusive);
 
-    ecs.system<const VoxelChunk, const ChunkCoordinate>("VoxelChunkMesher-EnqueueChunkBuild")
+    // only chunk that have a mesh component ready to receive the data after the meshing
+    ecs.system<const VoxelChunk, const ChunkCoordinate, VoxelChunkMesh>("VoxelChunkMesher-EnqueueChunkBuild")
         .kind(flecs::PostUpdate)
         .with<VoxelChunkMeshState, voxel_chunk_mesh_state::Dirty>()
-        .with<VoxelChunkMesh>() // only chunk that have a mesh component ready to receive the data after the meshing
-        .each([this](const flecs::entity e, const VoxelChunk &chunk, const ChunkCoordinate &pos) {
-            enqueue_meshing_system(e, chunk, pos);
+        .each([this](const flecs::entity e, const VoxelChunk &chunk, const ChunkCoordinate &pos, VoxelChunkMesh &mesh) {
+            enqueue_meshing_system(e, chunk, pos, mesh);
+        });
+
+    ecs.observer<const VoxelChunk, const ChunkCoordinate>("VoxelChunkMesher-RemeshNeighbors")
+        .event(flecs::OnSet)
+        .each([](flecs::entity e, const VoxelChunk&, const ChunkCoordinate& pos) {
+            remesh_neighbors_observer(e, pos);
         });
 
     ecs.system("VoxelChunkMesher-PollMeshingResults")
@@ -73,12 +125,8 @@ void VoxelChunkMesher::init(flecs::world &ecs) {
             poll_meshing_results_system(it);
         });
 
-    // init workers
-    size_t numThreads = std::max(1u, std::thread::hardware_concurrency() - 1);
-
-    for (size_t i = 0; i < numThreads; i++) {
-        m_workerThreads.emplace_back([this, i] { worker_loop(i); });
-    }
+    m_scheduler = ecs.get_mut<TaskScheduler>();
+    m_frameBudget = ecs.get_mut<FrameBudget>();
 }
 
 void VoxelChunkMesher::Register(flecs::world &ecs) {
@@ -86,87 +134,188 @@ void VoxelChunkMesher::Register(flecs::world &ecs) {
     ecs.get_mut<VoxelChunkMesher>()->init(ecs);
 }
 
-void VoxelChunkMesher::enqueue_meshing_system(flecs::entity e, const VoxelChunk &chunk, const ChunkCoordinate &pos) {
+void VoxelChunkMesher::enqueue_meshing_system(flecs::entity e, const VoxelChunk &chunk, const ChunkCoordinate &pos,
+                                              VoxelChunkMesh &mesh) {
     auto* textureManager = e.world().get_mut<VoxelTextureManager>();
 
     TaskMeshingInput input;
     input.chunkCoord = pos;
+    input.entity = e;
+    input.buildVersion = ++mesh.buildVersion;
+    // the previous build can't be applied anymore
+    mesh.meshingCancellation.cancel();
+    mesh.meshingCancellation = CancellationToken::create();
+    input.cancellation = mesh.meshingCancellation;
     input.voxels = chunk.voxels;
+    input.mode = m_meshingMode.load(std::memory_order_relaxed);
+
+    // Neighbors, to cull the faces hidden by the adjacent chunks
+    const auto* chunkManager = e.world().get<ChunkManager>();
+    for (int face = 0; face < 6; face++) {
+        const glm::ivec3 neighborPos = glm::ivec3(pos) + FACE_DIRECTIONS[face];
+        if (flecs::entity neighbor = chunkManager->find_chunk(neighborPos)) {
+            input.neighbors[face] = neighbor.get<VoxelChunk>()->voxels;
+        } else if (!chunkManager->is_chunk_empty(neighborPos)) {
+            input.missingNeighbors |= 1u << face;
+        }
+    }
 
     // Texture slots. Said to prepare some texture in the gpu
-    for (const auto& [textureID, voxelID] : chunk.textureIDs) {
+    for (const auto& [textureID, voxelID] : *chunk.textureIDs) {
         input.textureIDs[voxelID] =
             textureManager->request_texture_slot(textureID);
     }
 
-    enqueue(std::move(input));
+    // chunks close to the loaders or in their direction of travel are meshed first
+    enqueue(std::move(input), chunkManager->get_streaming_priority(pos));
     e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::Meshing>();
 }
 
 void VoxelChunkMesher::poll_meshing_results_system(flecs::iter &it) {
-    auto results = poll_results(16);
-
-    auto query = it.world().query_builder<VoxelChunkMesh, const ChunkCoordinate>()
-            .with<VoxelChunkMeshState, voxel_chunk_mesh_state::Meshing>()
-            .build();
-
-    for (auto& result : results) {
-        query.each([&result](flecs::entity e, VoxelChunkMesh &mesh, const ChunkCoordinate &coord) {
-            if (coord == result.chunkCoord) {
-                mesh.vertices = std::move(result.vertices);
-                mesh.indices = std::move(result.indices);
-                mesh.vertexCount = mesh.vertices.size();
-                mesh.indexCount = mesh.indices.size();
-                e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::ReadyForUpload>();
-            }
-        });
-    }
+    flecs::world world = it.world();
 
-}
-
-void VoxelChunkMesher::worker_loop(size_t id) {
-    LOG_DEBUG("VoxelChunkMesher", "Worker thread {} started", id);
+    while (m_frameBudget->has_time_for(FrameBudgetStage::MeshIntake)) {
+        std::optional<TaskMeshingOutput> result = m_results.pop();
+        if (!result) break;
 
-    while (true) {
-        TaskMeshingInput input;
-        {
-            std::unique_lock<std::mutex> lock(m_taskMutex);
-            m_taskCv.wait(lock, [this] {
-                return m_stop || !m_taskQueue.empty();
-            });
+        FrameBudgetScope budgetScope(*m_frameBudget, FrameBudgetStage::MeshIntake);
 
-            if (m_stop && m_taskQueue.empty()) {
-                LOG_DEBUG("VoxelChunkMesher", "Worker thread {} stopping", id);
-                return;
-            }
+        // the chunk may have been unloaded, or sent to meshing again, while this mesh was built
+        flecs::entity e = world.entity(result->entity);
+        if (!e.is_alive() || !e.has<VoxelChunkMeshState, voxel_chunk_mesh_state::Meshing>()) continue;
 
-            input = std::move(m_taskQueue.front());
-            m_taskQueue.pop();
-            m_pendingCoords.erase(input.chunkCoord);
-        }
+        auto* mesh = e.get_mut<VoxelChunkMesh>();
+        if (!mesh || mesh->buildVersion != result->buildVersion) continue;
 
-        TaskMeshingOutput result = build_mesh(input);
+        mesh->faces = std::move(result->faces);
+        mesh->faceCount = mesh->faces.size();
+        mesh->missingNeighbors = result->missingNeighbors;
+        e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::ReadyForUpload>();
+    }
+}
 
-        {
-            std::lock_guard<std::mutex> lock(m_resultMutex);
-            m_resultQueue.push(std::move(result));
+void VoxelChunkMesher::remesh_neighbors_observer(flecs::entity e, const ChunkCoordinate &pos) {
+    const auto* chunkManager = e.world().get<ChunkManager>();
+    if (!chunkManager) return;
+
+    for (int face = 0; face < 6; face++) {
+        flecs::entity neighbor = chunkManager->find_chunk(glm::ivec3(pos) + FACE_DIRECTIONS[face]);
+        if (!neighbor || neighbor == e) continue;
+
+        auto* mesh = neighbor.get_mut<VoxelChunkMesh>();
+        if (!mesh) continue; // not meshed yet, it will see this chunk
+
+        // the neighbor sees this chunk through its opposite face
+        const uint8_t faceBit = 1u << (face ^ 1);
+        if (!(mesh->missingNeighbors & faceBit)) continue;
+        mesh->missingNeighbors &= ~faceBit;
+
+        if (neighbor.has<VoxelChunkMeshState, voxel_chunk_mesh_state::Meshing>() ||
+            neighbor.has<VoxelChunkMeshState, voxel_chunk_mesh_state::ReadyForUpload>() ||
+            neighbor.has<VoxelChunkMeshState, voxel_chunk_mesh_state::Uploading>()) {
+            // the mesh being built or uploaded doesn't know this chunk, rebuild it after the upload
+            mesh->remeshPending = true;
+        } else if (neighbor.has<VoxelChunkMeshState, voxel_chunk_mesh_state::Clean>()) {
+            neighbor.add<VoxelChunkMeshState, voxel_chunk_mesh_state::Dirty>();
         }
     }
 }
 
+void VoxelChunkMesher::run_meshing_task(const TaskMeshingInput &input) {
+    m_queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+
+    // nobody will consume the result anymore
+    if (m_stop || input.cancellation.is_cancelled()) return;
+
+    m_results.push(build_mesh(input));
+}
+
 TaskMeshingOutput VoxelChunkMesher::build_mesh(const TaskMeshingInput &input) {
     TaskMeshingOutput result;
     result.chunkCoord = input.chunkCoord;
+    result.entity = input.entity;
+    result.buildVersion = input.buildVersion;
+    result.missingNeighbors = input.missingNeighbors;
     result.success = true;
 
-    // Lambda to get voxel at (x, y, z) with bounds checking
-    auto at = [&input](int x, int y, int z) -> uint8_t {
-        if (x < 0 || x >= CHUNK_SIZE ||
-            y < 0 || y >= CHUNK_SIZE ||
-            z < 0 || z >= CHUNK_SIZE) {
-            return 0;
+    // Fast path: nothing to mesh in a chunk full of air
+    if (input.voxels->is_uniform() && input.voxels->get_uniform_value() == 0) {
+        return result;
+    }
+
+    // Decode the paletted storage once, the loops below read each voxel several times
+    thread_local std::array<uint8_t, CHUNK_VOLUME> voxels;
+    input.voxels->unpack(voxels.data());
+
+    // Texture slot of each voxel value, looked up once instead of for every face
+    std::array<uint16_t, 256> textureSlots = {};
+    for (const auto& [voxel, textureSlot] : input.textureIDs) {
+        textureSlots[voxel] = textureSlot;
+    }
+
+    NeighborSlabs neighborSlabs;
+    build_neighbor_slabs(input, neighborSlabs);
+
+    if (input.mode == MeshingMode::Reference) {
+        build_mesh_reference(voxels.data(), neighborSlabs, textureSlots, result);
+        return result;
+    }
+
+    thread_local FaceMasks faceMasks;
+    build_face_masks(voxels.data(), neighborSlabs, faceMasks);
+
+    if (input.mode == MeshingMode::Bitmask) {
+        build_mesh_bitmask(voxels.data(), textureSlots, faceMasks, result);
+    } else {
+        build_mesh_greedy(voxels.data(), textureSlots, faceMasks, result);
+    }
+
+    return result;
+}
+
+void VoxelChunkMesher::build_neighbor_slabs(const TaskMeshingInput &input, NeighborSlabs &neighborSlabs) {
+    for (int face = 0; face < 6; face++) {
+        auto& slab = neighborSlabs.slabs[face];
+        const auto& neighbor = input.neighbors[face];
+
+        if (!neighbor || (neighbor->is_uniform() && neighbor->get_uniform_value() == 0)) {
+            slab.fill(0);
+            continue;
+        }
+        if (neighbor->is_uniform()) {
+            slab.fill(UINT32_MAX);
+            continue;
+        }
+
+        // layer of the neighbor touching this chunk: its first layer for a positive face, its last one otherwise
+        const int axis = face / 2;
+        const int depth = (face & 1) ? 0 : CHUNK_SIZE - 1;
+        for (int v = 0; v < CHUNK_SIZE; v++) {
+            uint32_t row = 0;
+            for (int u = 0; u < CHUNK_SIZE; u++) {
+                const glm::ivec3 neighborPos = column_voxel(axis, v * CHUNK_SIZE + u, depth);
+                row |= static_cast<uint32_t>(neighbor->get(voxel_index(neighborPos)) != 0) << u;
+            }
+            slab[v] = row;
+        }
+    }
+}
+
+void VoxelChunkMesher::build_mesh_reference(const uint8_t* voxels, const NeighborSlabs& neighborSlabs,
+                                            const std::array<uint16_t, 256>& textureSlots, TaskMeshingOutput& result) {
+    // Lambda to know if the voxel at (x, y, z) is solid, looking into the neighbor slabs outside the chunk
+    auto is_solid = [voxels, &neighborSlabs](int x, int y, int z) -> bool {
+        const glm::ivec3 pos(x, y, z);
+        for (int axis = 0; axis < 3; axis++) {
+            if (pos[axis] < 0 || pos[axis] >= CHUNK_SIZE) {
+                const int face = axis * 2 + (pos[axis] >= CHUNK_SIZE ? 1 : 0);
+                return neighborSlabs.is_solid(face, pos[(axis + 1) % 3], pos[(axis + 2) % 3]);
+            }
         }
-        return (*input.voxels)[x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE];
+        return voxels[x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE] != 0;
+    };
+    auto at = [voxels](int x, int y, int z) -> uint8_t {
+        return voxels[x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE];
     };
 
     for (int x = 0; x < CHUNK_SIZE; x++) {
@@ -180,73 +329,170 @@ TaskMeshingOutput VoxelChunkMesher::build_mesh(const TaskMeshingInput &input) {
                     int ny = y + ((face == 2) ? -1 : (face == 3) ? 1 : 0);
                     int nz = z + ((face == 4) ? -1 : (face == 5) ? 1 : 0);
 
-                    bool isVisible = (at(nx, ny, nz) == 0);
+                    bool isVisible = !is_solid(nx, ny, nz);
                     if (!isVisible) continue;
 
-                    static const float verts[6][4][3] = {
-                        // Face 0: -X
-                        {{0, 0, 0}, {0, 1, 0}, {0, 1, 1}, {0, 0, 1}},
-                        // Face 1: +X
-                        {{1, 0, 0}, {1, 0, 1}, {1, 1, 1}, {1, 1, 0}},
-                        // Face 2: -Y
-                        {{0, 0, 0}, {0, 0, 1}, {1, 0, 1}, {1, 0, 0}},
-                        // Face 3: +Y
-                        {{0, 1, 0}, {1, 1, 0}, {1, 1, 1}, {0, 1, 1}},
-                        // Face 4: -Z
-                        {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}},
-                        // Face 5: +Z
-                        {{0, 0, 1}, {0, 1, 1}, {1, 1, 1}, {1, 0, 1}}
-                    };
-
-                    static const uint8_t faceUVs[4][2] = {
-                        {0, 0}, {0, 1}, {1, 1}, {1, 0}
-                    };
-
-                    uint32_t textureSlot = 0;
-                    auto it = input.textureIDs.find(voxel);
-                    if (it != input.textureIDs.end()) {
-                        textureSlot = it->second;
-                    }
+                    push_face(result, face, {x, y, z}, 1, 1, textureSlots[voxel], face_uv_rotation({x, y, z}));
+                }
+            }
+        }
+    }
+}
 
-                    uint32_t uvOffset = (x * 73856093) ^ (y * 19349663) ^ (z * 83492791);
-                    uvOffset = uvOffset % 4;
+void VoxelChunkMesher::build_face_masks(const uint8_t* voxels, const NeighborSlabs& neighborSlabs, FaceMasks& masks) {
+    static_assert(CHUNK_SIZE == 32, "Face masks store a chunk column in a 32-bit word");
+
+    // Occupancy columns of each axis
+    std::array<uint32_t, CHUNK_SIZE * CHUNK_SIZE> columnsX; // [z * CHUNK_SIZE + y], bit x
+    std::array<uint32_t, CHUNK_SIZE * CHUNK_SIZE> columnsY; // [x * CHUNK_SIZE + z], bit y
+    std::array<uint32_t, CHUNK_SIZE * CHUNK_SIZE> columnsZ; // [y * CHUNK_SIZE + x], bit z
+
+    // X columns are the rows of the x-fastest layout, 8 voxels are tested at once
+    for (int row = 0; row < CHUNK_SIZE * CHUNK_SIZE; row++) {
+        const uint8_t* voxelRow = voxels + row * CHUNK_SIZE;
+        uint32_t rowBits = 0;
+        for (int group = 0; group < CHUNK_SIZE / 8; group++) {
+            uint64_t word;
+            std::memcpy(&word, voxelRow + group * 8, sizeof(word));
+            rowBits |= nonzero_bytes_mask(word) << (group * 8);
+        }
+        columnsX[row] = rowBits;
+    }
 
-                    uint32_t baseIdx = result.vertices.size();
-                    float fx = static_cast<float>(x);
-                    float fy = static_cast<float>(y);
-                    float fz = static_cast<float>(z);
+    // The two other axes are bit transposes of the X columns
+    std::array<uint32_t, CHUNK_SIZE> matrix;
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        // rows y, bits x -> rows x, bits y
+        std::copy_n(&columnsX[z * CHUNK_SIZE], CHUNK_SIZE, matrix.begin());
+        transpose_32x32(matrix.data());
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            columnsY[x * CHUNK_SIZE + z] = matrix[x];
+        }
+    }
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        // rows z, bits x -> rows x, bits z
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            matrix[z] = columnsX[z * CHUNK_SIZE + y];
+        }
+        transpose_32x32(matrix.data());
+        std::copy_n(matrix.begin(), CHUNK_SIZE, &columnsZ[y * CHUNK_SIZE]);
+    }
 
-                    for (int i = 0; i < 4; i++) {
-                        TerrainVertex3d vertex;
+    // A face is visible where a solid voxel has air on that side.
+    // The neighbor slabs give the voxel past each end of the columns.
+    const std::array<uint32_t, CHUNK_SIZE * CHUNK_SIZE>* columns[3] = {&columnsX, &columnsY, &columnsZ};
+    for (int axis = 0; axis < 3; axis++) {
+        auto& negative = masks.faces[axis * 2];
+        auto& positive = masks.faces[axis * 2 + 1];
+        const auto& negativeSlab = neighborSlabs.slabs[axis * 2];
+        const auto& positiveSlab = neighborSlabs.slabs[axis * 2 + 1];
+
+        for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+            const uint32_t column = (*columns[axis])[i];
+            const uint32_t before = (negativeSlab[i / CHUNK_SIZE] >> (i % CHUNK_SIZE)) & 1u;
+            const uint32_t after = (positiveSlab[i / CHUNK_SIZE] >> (i % CHUNK_SIZE)) & 1u;
+            negative[i] = column & ~((column << 1) | before);
+            positive[i] = column & ~((column >> 1) | (after << (CHUNK_SIZE - 1)));
+        }
+    }
+}
 
-                        vertex.x = static_cast<uint32_t>(
-                            std::round((fx + verts[face][i][0]) / CHUNK_SIZE * 1023.0f));
-                        vertex.y = static_cast<uint32_t>(
-                            std::round((fy + verts[face][i][1]) / CHUNK_SIZE * 1023.0f));
-                        vertex.z = static_cast<uint32_t>(
-                            std::round((fz + verts[face][i][2]) / CHUNK_SIZE * 1023.0f));
+void VoxelChunkMesher::build_mesh_bitmask(const uint8_t* voxels, const std::array<uint16_t, 256>& textureSlots,
+                                          const FaceMasks& masks, TaskMeshingOutput& result) {
+    size_t faceCount = 0;
+    for (const auto& faceColumns : masks.faces) {
+        for (uint32_t column : faceColumns) {
+            faceCount += std::popcount(column);
+        }
+    }
+    result.faces.reserve(faceCount);
+
+    for (int face = 0; face < 6; face++) {
+        const int axis = face / 2;
+        for (int column = 0; column < CHUNK_SIZE * CHUNK_SIZE; column++) {
+            uint32_t bits = masks.faces[face][column];
+            while (bits) {
+                const int depth = std::countr_zero(bits);
+                bits &= bits - 1;
+
+                const glm::ivec3 pos = column_voxel(axis, column, depth);
+                push_face(result, face, pos, 1, 1, textureSlots[voxels[voxel_index(pos)]], face_uv_rotation(pos));
+            }
+        }
+    }
+}
 
-                        int uvIdx = (uvOffset + i) % 4;
-                        vertex.u = faceUVs[uvIdx][0];
-                        vertex.v = faceUVs[uvIdx][1];
+void VoxelChunkMesher::build_mesh_greedy(const uint8_t* voxels, const std::array<uint16_t, 256>& textureSlots,
+                                         const FaceMasks& masks, TaskMeshingOutput& result) {
+    // Visible faces of one slice, indexed [v * CHUNK_SIZE + u] like the face mask columns.
+    // 0 = no face, otherwise texture slot + 1
+    std::array<uint16_t, CHUNK_SIZE * CHUNK_SIZE> mask;
+
+    for (int face = 0; face < 6; face++) {
+        const int axis = face / 2;          // face normal axis
+        const int uAxis = (axis + 1) % 3;   // the two axes of the face plane
+        const int vAxis = (axis + 2) % 3;
+        const auto& faceColumns = masks.faces[face];
+
+        // Slices having at least one visible face
+        uint32_t slices = 0;
+        for (uint32_t column : faceColumns) {
+            slices |= column;
+        }
 
-                        vertex.textureSlot = textureSlot;
-                        vertex.faceIndex = face;
+        while (slices) {
+            const int slice = std::countr_zero(slices);
+            slices &= slices - 1;
 
-                        result.vertices.push_back(vertex);
+            for (int column = 0; column < CHUNK_SIZE * CHUNK_SIZE; column++) {
+                uint16_t key = 0;
+                if ((faceColumns[column] >> slice) & 1u) {
+                    key = textureSlots[voxels[voxel_index(column_voxel(axis, column, slice))]] + 1;
+                }
+                mask[column] = key;
+            }
+
+            // Merge the faces: grow each quad along u first, then along v while the whole row matches
+            for (int v = 0; v < CHUNK_SIZE; v++) {
+                for (int u = 0; u < CHUNK_SIZE;) {
+                    const uint16_t key = mask[v * CHUNK_SIZE + u];
+                    if (key == 0) {
+                        u++;
+                        continue;
                     }
 
-                    result.indices.push_back(baseIdx + 0);
-                    result.indices.push_back(baseIdx + 1);
-                    result.indices.push_back(baseIdx + 2);
+                    int width = 1;
+                    while (u + width < CHUNK_SIZE && mask[v * CHUNK_SIZE + u + width] == key) {
+                        width++;
+                    }
+
+                    int height = 1;
+                    while (v + height < CHUNK_SIZE) {
+                        bool rowMatches = true;
+                        for (int k = 0; k < width; k++) {
+                            if (mask[(v + height) * CHUNK_SIZE + u + k] != key) {
+                                rowMatches = false;
+                                break;
+                            }
+                        }
+                        if (!rowMatches) break;
+                        height++;
+                    }
 
-                    result.indices.push_back(baseIdx + 0);
-                    result.indices.push_back(baseIdx + 2);
-                    result.indices.push_back(baseIdx + 3);
+                    for (int dv = 0; dv < height; dv++) {
+                        std::fill_n(&mask[(v + dv) * CHUNK_SIZE + u], width, 0);
+                    }
+
+                    glm::ivec3 origin;
+                    origin[axis] = slice;
+                    origin[uAxis] = u;
+                    origin[vAxis] = v;
+
+                    // not rotated, the texture repeats once per voxel across the merged quad
+                    push_face(result, face, origin, width, height, key - 1, 0);
+                    u += width;
                 }
             }
         }
     }
-
-    return result;
 }
@@ -1,87 +1,136 @@
 #pragma once
 
-#include <condition_variable>
+#include <array>
+#include <atomic>
 #include <flecs.h>
 #include <memory>
-#include <mutex>
-#include <queue>
-#include <thread>
 #include <unordered_map>
 
 #include "core/main_components.h"
 #include "core/resource/asset_id.h"
+#include "core/task/CancellationToken.h"
+#include "core/task/MpscQueue.h"
+#include "core/task/TaskScheduler.h"
 #include "core/world/world_components.h"
 #include "renderer/rendering_components.h"
 
+enum class MeshingMode {
+    Reference, // one quad per visible voxel face, found by testing the 6 neighbors of every voxel
+    Bitmask,   // one quad per visible voxel face, found with bit operations on occupancy columns
+    Greedy,    // bitmask face culling, then coplanar faces with the same texture merged into bigger quads
+};
+
 struct TaskMeshingInput {
     glm::ivec3 chunkCoord;
-    std::shared_ptr<const std::array<uint8_t, CHUNK_VOLUME>> voxels;
-    std::unordered_map<AssetID, uint8_t> textureIDs;
+    flecs::entity_t entity = 0; // chunk entity receiving the mesh
+    uint32_t buildVersion = 0;  // VoxelChunkMesh::buildVersion when the task was submitted
+    CancellationToken cancellation;
+    std::shared_ptr<const PalettedVoxelStorage> voxels;
+    std::unordered_map<uint8_t, uint16_t> textureIDs; // voxel value -> texture slot
+    MeshingMode mode = MeshingMode::Greedy;
+
+    // Face-adjacent chunks, indexed by face (-X, +X, -Y, +Y, -Z, +Z). Null = air
+    std::array<std::shared_ptr<const PalettedVoxelStorage>, 6> neighbors;
+    // Bit per face whose neighbor is not loaded yet (meshed as air, the chunk is remeshed once it loads)
+    uint8_t missingNeighbors = 0;
 };
 
 struct TaskMeshingOutput {
     glm::ivec3 chunkCoord;
+    flecs::entity_t entity = 0;
+    uint32_t buildVersion = 0;
+    uint8_t missingNeighbors = 0;
 
     // moved ownership to not copy large data
-    std::vector<TerrainVertex3d> vertices;
-    std::vector<uint32_t> indices;
+    std::vector<TerrainFace> faces;
 
     bool success = false;
 };
 
+class FrameBudget;
+
 class VoxelChunkMesher {
 public:
     VoxelChunkMesher() = default;
     ~VoxelChunkMesher();
+
+    /**
+     * Stop meshing. The tasks still queued in the scheduler return without doing anything.
+     */
     void shutdown();
 
     void init(flecs::world& ecs);
     void static Register(flecs::world& ecs);
 
-    size_t pending_count() const {
-        std::lock_guard<std::mutex> lock(m_taskMutex);
-        return m_pendingCoords.size();
-    }
-
-    size_t completed_count() const {
-        std::lock_guard<std::mutex> lock(m_resultMutex);
-        return m_resultQueue.size();
-    }
+    /**
+     * Number of meshing tasks submitted and not started yet
+     */
+    size_t pending_count() const { return m_queuedTasks.load(std::memory_order_relaxed); }
 
-private:
-    void enqueue(TaskMeshingInput&& taskInput);
+    /**
+     * Number of meshes built and waiting to be delivered to their chunk
+     */
+    size_t completed_count() const { return m_results.size_approx(); }
 
     /**
-     * Check if a chunk at the given coordinate is already pending meshing.
-     * @param coord Chunk coordinate
-     * @return True if the chunk is pending meshing, false otherwise
+     * Meshing mode used by the next enqueued chunks. Chunks already meshed are not rebuilt.
      */
-    bool is_pending(const glm::ivec3& coord) const {
-        std::lock_guard<std::mutex> lock(m_taskMutex);
-        return m_pendingCoords.count(coord) > 0;
-    }
+    void set_meshing_mode(MeshingMode mode) { m_meshingMode.store(mode, std::memory_order_relaxed); }
+    MeshingMode get_meshing_mode() const { return m_meshingMode.load(std::memory_order_relaxed); }
 
-    std::vector<TaskMeshingOutput> poll_results(size_t maxResults = 30);
+private:
+    void enqueue(TaskMeshingInput&& taskInput, TaskPriority priority);
 
-    void enqueue_meshing_system(flecs::entity e, const VoxelChunk& chunk, const ChunkCoordinate& pos);
+    void enqueue_meshing_system(flecs::entity e, const VoxelChunk& chunk, const ChunkCoordinate& pos,
+                                VoxelChunkMesh& mesh);
     void poll_meshing_results_system(flecs::iter& it);
 
-    // Worker thread function
-    void worker_loop(size_t id);
+    /**
+     * Remesh the loaded neighbors that were meshed while this chunk was missing
+     */
+    static void remesh_neighbors_observer(flecs::entity e, const ChunkCoordinate& pos);
+
+    // Task run by the scheduler workers
+    void run_meshing_task(const TaskMeshingInput& input);
     TaskMeshingOutput build_mesh(const TaskMeshingInput& input);
 
+    /**
+     * Visible faces of a chunk, one 32-bit column per voxel line along the face normal axis.
+     * faces[face][v * CHUNK_SIZE + u] bit d is the face of the voxel at depth d along the axis of the face,
+     * u and v being the two other axes in (axis + 1) % 3, (axis + 2) % 3 order.
+     */
+    struct FaceMasks {
+        std::array<uint32_t, CHUNK_SIZE * CHUNK_SIZE> faces[6];
+    };
+
+    /**
+     * Occupancy of the neighbor voxels touching each face of the chunk.
+     * slabs[face][v] bit u, with u and v the face plane axes in the FaceMasks order.
+     */
+    struct NeighborSlabs {
+        std::array<uint32_t, CHUNK_SIZE> slabs[6];
+
+        bool is_solid(int face, int u, int v) const { return (slabs[face][v] >> u) & 1u; }
+    };
+
+    static void build_neighbor_slabs(const TaskMeshingInput& input, NeighborSlabs& neighborSlabs);
+    static void build_face_masks(const uint8_t* voxels, const NeighborSlabs& neighborSlabs, FaceMasks& masks);
+
+    static void build_mesh_reference(const uint8_t* voxels, const NeighborSlabs& neighborSlabs,
+                                     const std::array<uint16_t, 256>& textureSlots, TaskMeshingOutput& result);
+    static void build_mesh_bitmask(const uint8_t* voxels, const std::array<uint16_t, 256>& textureSlots,
+                                   const FaceMasks& masks, TaskMeshingOutput& result);
+    static void build_mesh_greedy(const uint8_t* voxels, const std::array<uint16_t, 256>& textureSlots,
+                                  const FaceMasks& masks, TaskMeshingOutput& result);
 
-    std::vector<std::thread> m_workerThreads;
 
-    // task queue input
-    mutable std::mutex m_taskMutex;
-    std::condition_variable m_taskCv;
-    std::queue<TaskMeshingInput> m_taskQueue;
-    std::unordered_set<glm::ivec3, IVec3Hash> m_pendingCoords;
+    TaskScheduler* m_scheduler = nullptr;
+    FrameBudget* m_frameBudget = nullptr; // built meshes are taken within the frame budget
+    std::atomic<size_t> m_queuedTasks = 0;
 
-    // result queue output
-    mutable std::mutex m_resultMutex;
-    std::queue<TaskMeshingOutput> m_resultQueue;
+    // Built meshes, pushed by the workers and delivered by the main thread straight to their entity
+    MpscQueue<TaskMeshingOutput> m_results;
 
-    std::atomic<bool> m_stop;
+    std::atomic<bool> m_stop = false;
+    std::atomic<MeshingMode> m_meshingMode = MeshingMode::Greedy;
 };
@@ -4,12 +4,14 @@
 
 #include "VoxelTerrainRenderer.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "../rendering_components.h"
 #include "core/GameState.h"
 #include "core/main_components.h"
 #include "core/log/Logger.h"
+#include "core/task/FrameBudget.h"
 #include "renderer/Renderer.h"
 #include "renderer/render_types.h"
 #include <glm/glm.hpp>
@@ -63,6 +65,9 @@ void VoxelTerrainRenderer::init() {
             .setMaxVersions(8);
     m_uboBuffer = m_backend->device->createBuffer(uboBufferDesc);
 
+    m_stagingRing = std::make_unique<StagingRingBuffer>(m_backend, FRAME_STAGING_RING_SIZE, "Frame Staging Ring Buffer");
+    m_uploadContext = std::make_unique<UploadContext>(m_backend);
+
     // Set 0: Per-frame bindings (camera/view data)
     auto frameBindingLayoutDesc = nvrhi::BindingLayoutDesc()
             .setVisibility(nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel)
@@ -74,31 +79,14 @@ void VoxelTerrainRenderer::init() {
             .addItem(nvrhi::BindingSetItem::ConstantBuffer(0, m_uboBuffer));
     m_frameBindingSet = m_backend->device->createBindingSet(frameBindingSetDesc, m_frameBindingLayout);
 
-    // Set 1: Per-buffer bindings (chunk data)
+    // Set 1: Chunk data bindings
     auto bufferBindingLayoutDesc = nvrhi::BindingLayoutDesc()
             .setVisibility(nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel)
             .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0)) // OUB buffer for per-chunk data
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(1)) // faces, pulled by the vertex shader
             .setBindingOffsets(bindingOffsets);
     m_bufferBindingLayout = m_backend->device->createBindingLayout(bufferBindingLayoutDesc);
 
-
-    // Create Vertex Attribute Input
-    nvrhi::VertexAttributeDesc vertexAttrs[] = {
-        nvrhi::VertexAttributeDesc()
-        .setName("POSITION_UV")
-        .setFormat(nvrhi::Format::R32_UINT)
-        .setOffset(0)
-        .setElementStride(sizeof(TerrainVertex3d)),
-        nvrhi::VertexAttributeDesc()
-        .setName("TEXTURESLOT_FACEINDEX")
-        .setFormat(nvrhi::Format::R16_UINT)
-        .setOffset(4)
-        .setElementStride(sizeof(TerrainVertex3d))
-    };
-
-    nvrhi::InputLayoutHandle inputLayout = m_backend->device->createInputLayout(
-        vertexAttrs, std::size(vertexAttrs), m_vertexShader);
-
     nvrhi::Format swapchainNvrhiFormat = m_backend->swapchainFormat == VK_FORMAT_B8G8R8A8_UNORM
                                              ? nvrhi::Format::BGRA8_UNORM
                                              : nvrhi::Format::RGBA8_UNORM;
@@ -117,8 +105,8 @@ void VoxelTerrainRenderer::init() {
     renderState.depthStencilState.depthFunc = nvrhi::ComparisonFunc::LessOrEqual;
     renderState.depthStencilState.stencilEnable = false;
 
+    // No input layout, the vertex shader builds the quads from the face buffer
     auto pipelineDesc = nvrhi::GraphicsPipelineDesc()
-            .setInputLayout(inputLayout)
             .setVertexShader(m_vertexShader)
             .setPixelShader(m_pixelShader)
             .setPrimType(nvrhi::PrimitiveType::TriangleList)
@@ -127,32 +115,83 @@ void VoxelTerrainRenderer::init() {
             .addBindingLayout(m_bufferBindingLayout) // Set 1
             .addBindingLayout(m_textureManager->get_binding_layout()); // Set 2 - texture array
     m_pipeline = m_backend->device->createGraphicsPipeline(pipelineDesc, framebufferInfo);
+
+    init_culling_pipeline();
+
+    // Mesh arena, created upfront so its binding sets never change
+    m_meshArena = std::make_unique<VoxelBuffer>(m_backend, m_stagingRing.get());
+
+    auto meshArenaBindingSetDesc = nvrhi::BindingSetDesc()
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_meshArena->get_oub_buffer()))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_meshArena->get_mesh_buffer()));
+    m_meshArenaBindingSet = m_backend->device->createBindingSet(meshArenaBindingSetDesc, m_bufferBindingLayout);
+
+    auto cullBindingSetDesc = nvrhi::BindingSetDesc()
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_meshArena->get_bounds_buffer()))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_meshArena->get_indirect_buffer()))
+            .addItem(nvrhi::BindingSetItem::RawBuffer_UAV(0, m_meshArena->get_culled_indirect_buffer()));
+    m_meshArenaCullBindingSet = m_backend->device->createBindingSet(cullBindingSetDesc, m_cullBindingLayout);
+}
+
+void VoxelTerrainRenderer::init_culling_pipeline() {
+    std::shared_ptr<ShaderResource> cullShaderRes;
+    try {
+        cullShaderRes = m_resourceSystem->load<ShaderResource>("TerrainCullChunks.comp", ResourceType::SHADER);
+    } catch (const std::exception &e) {
+        LOG_FATAL("VoxelTerrainRenderer", "Error when reading terrain culling shader: {}", e.what());
+        throw e;
+    }
+
+    m_cullShader = m_backend->device->createShader(
+        nvrhi::ShaderDesc().setShaderType(nvrhi::ShaderType::Compute),
+        cullShaderRes->get_data(), cullShaderRes->get_data_size());
+
+    auto bindingOffsets = nvrhi::VulkanBindingOffsets()
+            .setShaderResourceOffset(0)
+            .setUnorderedAccessViewOffset(2)
+            .setSamplerOffset(3)
+            .setConstantBufferOffset(3);
+    auto bindingLayoutDesc = nvrhi::BindingLayoutDesc()
+            .setVisibility(nvrhi::ShaderType::Compute)
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0)) // chunk bounds
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(1)) // draw slots
+            .addItem(nvrhi::BindingLayoutItem::RawBuffer_UAV(0))        // culled draws
+            .addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(CullPushConstants)))
+            .setBindingOffsets(bindingOffsets);
+    m_cullBindingLayout = m_backend->device->createBindingLayout(bindingLayoutDesc);
+
+    auto pipelineDesc = nvrhi::ComputePipelineDesc()
+            .setComputeShader(m_cullShader)
+            .addBindingLayout(m_cullBindingLayout);
+    m_cullPipeline = m_backend->device->createComputePipeline(pipelineDesc);
 }
 
 void VoxelTerrainRenderer::destroy() {
     m_backend->device->waitForIdle();
-    m_chunkBuffers.clear();
-    m_chunkBufferBindingSets.clear();
+    m_meshArenaBindingSet = nullptr;
+    m_meshArenaCullBindingSet = nullptr;
+    m_meshArena.reset();
+    m_stagingRing.reset();
+    m_uploadContext.reset();
+    m_cullPipeline = nullptr;
+    m_cullShader = nullptr;
     m_pipeline = nullptr;
     m_pixelShader = nullptr;
     m_vertexShader = nullptr;
 }
 
-VoxelBuffer& VoxelTerrainRenderer::create_buffer() {
-    // create initial chunk buffer
-    VoxelBuffer& buffer = m_chunkBuffers.emplace_back(m_backend);
-
-    auto initialBufferBindingSetDesc = nvrhi::BindingSetDesc()
-            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, buffer.get_oub_buffer()));
-    m_chunkBufferBindingSets.push_back(
-        m_backend->device->createBindingSet(initialBufferBindingSetDesc, m_bufferBindingLayout));
+// --- ECS ---
 
-    // return index of the created buffer
-    return buffer;
+// The mesh is drawn, back to Clean, or Dirty if a neighbor loaded while it was built
+static void finish_mesh_upload(flecs::entity e, VoxelChunkMesh &mesh) {
+    if (mesh.remeshPending) {
+        mesh.remeshPending = false;
+        e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::Dirty>();
+    } else {
+        e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::Clean>();
+    }
 }
 
-// --- ECS ---
-
 void VoxelTerrainRenderer::Register(flecs::world &ecs) {
     auto *renderer = ecs.get_mut<Renderer>();
     auto *gameState = ecs.get_mut<GameState>();
@@ -171,21 +210,61 @@ void VoxelTerrainRenderer::Register(flecs::world &ecs) {
         ecs.get_mut<VoxelTextureManager>()
     );
     auto* voxelRenderer = renderer->voxelTerrainRenderer.get();
+    auto* frameBudget = ecs.get_mut<FrameBudget>();
 
     ecs.component<VoxelChunkMesh>();
 
-    ecs.system<VoxelChunkMesh, const Position>("VoxelTerrainRenderer-UploadVoxelChunkMesh")
+    ecs.system<Renderer>("VoxelTerrainRenderer-BeginUploads")
+            .kind(flecs::PreStore)
+            .each([voxelRenderer](flecs::entity e, Renderer &renderer) {
+                voxelRenderer->begin_uploads_system();
+            });
+
+    ecs.system<VoxelChunkMesh, const ChunkCoordinate>("VoxelTerrainRenderer-ActivateUploadedMeshes")
+            .kind(flecs::PreStore)
+            .with<VoxelChunkMeshState, voxel_chunk_mesh_state::Uploading>()
+            .each([voxelRenderer](flecs::entity e, VoxelChunkMesh &mesh, const ChunkCoordinate& coord) {
+                const auto *renderer = e.world().get<Renderer>();
+                if (!renderer || !renderer->frameContext.frameActive) return;
+                if (voxelRenderer->activate_uploaded_mesh_system(renderer->frameContext.commandList, mesh, coord)) {
+                    finish_mesh_upload(e, mesh);
+                }
+            });
+
+    ecs.system<VoxelChunkMesh, const ChunkCoordinate>("VoxelTerrainRenderer-UploadVoxelChunkMesh")
             .kind(flecs::PreStore)
             .with<VoxelChunkMeshState, voxel_chunk_mesh_state::ReadyForUpload>()
-            .each([voxelRenderer](flecs::entity e, VoxelChunkMesh &mesh, const Position& pos) {
+            .each([voxelRenderer, frameBudget](flecs::entity e, VoxelChunkMesh &mesh, const ChunkCoordinate& coord) {
                 const auto *renderer = e.world().get<Renderer>();
                 if (!renderer) {
                     LOG_ERROR("VoxelTerrainRenderer", "Can't upload chunk mesh, Renderer not found in ECS");
                     return;
                 }
+                // the mesh stays ReadyForUpload until a frame has time for it
+                if (!frameBudget->has_time_for(FrameBudgetStage::MeshUpload)) return;
+
+                FrameBudgetScope budgetScope(*frameBudget, FrameBudgetStage::MeshUpload);
                 auto &commandList = renderer->frameContext.commandList;
-                voxelRenderer->upload_chunk_mesh_system(commandList, mesh, pos);
-                e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::Clean>();
+                if (!voxelRenderer->upload_chunk_mesh_system(commandList, e, mesh, coord)) return;
+                if (mesh.uploadTicket != 0) {
+                    e.add<VoxelChunkMeshState, voxel_chunk_mesh_state::Uploading>();
+                } else {
+                    finish_mesh_upload(e, mesh);
+                }
+            });
+
+    ecs.system<Renderer>("VoxelTerrainRenderer-SubmitUploads")
+            .kind(flecs::PreStore)
+            .each([voxelRenderer](flecs::entity e, Renderer &renderer) {
+                voxelRenderer->submit_uploads_system();
+            });
+
+    ecs.system<Renderer>("VoxelTerrainRenderer-DefragmentBuffers")
+            .kind(flecs::PreStore)
+            .each([voxelRenderer](flecs::entity e, Renderer &renderer) {
+                if (!renderer.frameContext.frameActive) return;
+                flecs::world world = e.world();
+                voxelRenderer->defragment_buffers_system(world, renderer.frameContext.commandList);
             });
 
     ecs.system<Renderer>("VoxelTerrainRenderer-RenderTerrain")
@@ -193,7 +272,9 @@ void VoxelTerrainRenderer::Register(flecs::world &ecs) {
             .each([voxelRenderer](flecs::entity e, Renderer &renderer) {
                 if (!renderer.frameContext.frameActive) return;
                 e.world().each<Camera3d>([&](flecs::entity cam_entity, Camera3d &camera) {
-                    voxelRenderer->render_terrain_system(renderer, camera);
+                    const auto *cameraPosition = cam_entity.get<Position>();
+                    voxelRenderer->render_terrain_system(renderer, camera,
+                                                         cameraPosition ? glm::vec3(*cameraPosition) : glm::vec3(0.0f));
                 });
             });
 
@@ -201,109 +282,252 @@ void VoxelTerrainRenderer::Register(flecs::world &ecs) {
     ecs.observer<VoxelChunkMesh>("VoxelTerrainRenderer-CleanupVoxelChunkMesh")
             .event(flecs::OnRemove)
             .each([voxelRenderer](flecs::entity e, VoxelChunkMesh &mesh) {
-                if (mesh.is_allocated() && !voxelRenderer->m_chunkBuffers.empty()) {
-                    int bufferIndex = mesh.bufferIndex;
-                    voxelRenderer->m_chunkBuffers[bufferIndex].free(mesh);
+                mesh.meshingCancellation.cancel();
+                if (mesh.is_allocated() && voxelRenderer->m_meshArena) {
+                    voxelRenderer->m_meshArena->free(mesh);
                 }
+                voxelRenderer->release_previous_mesh(mesh);
             });
 
 }
 
-bool VoxelTerrainRenderer::upload_chunk_mesh_system(nvrhi::CommandListHandle cmd, VoxelChunkMesh &mesh, const Position &pos) {
-    // TODO use the buffer with the position
-    bool uploaded = false;
-    if (m_chunkBuffers.empty()) {
-        create_buffer();
+void VoxelTerrainRenderer::begin_uploads_system() {
+    m_stagingRing->begin_submission(m_backend->get_frame_number(), m_backend->get_completed_frame_number());
+    m_uploadContext->update();
+
+    // Reuse the memory of the meshes freed before the frames the GPU finished
+    m_meshArena->retire_freed_draw_slots(m_backend->get_completed_frame_number(), *m_uploadContext);
+}
+
+bool VoxelTerrainRenderer::upload_chunk_mesh_system(nvrhi::CommandListHandle cmd, flecs::entity_t owner, VoxelChunkMesh &mesh, const ChunkCoordinate &coord) {
+    mesh.uploadTicket = 0;
+
+    // Remeshed chunk, the previous mesh stays drawn until the new one is resident
+    if (mesh.is_allocated()) {
+        release_previous_mesh(mesh);
+        m_meshArena->detach(mesh.drawSlotIndex);
+        mesh.previousDrawSlotIndex = mesh.drawSlotIndex;
+
+        mesh.faceRegionStart = UINT32_MAX;
+        mesh.faceRegionCount = 0;
+        mesh.drawSlotIndex = UINT32_MAX;
     }
 
-    for (size_t i = 0; i < m_chunkBuffers.size() && !uploaded; i++) {
-        VoxelBuffer& buffer = m_chunkBuffers[i];
+    // Nothing visible (empty or fully hidden by its neighbors), don't take space in the buffers
+    if (mesh.faceCount == 0) {
+        release_previous_mesh(mesh);
+        return true;
+    }
 
-        if (!buffer.can_allocate(mesh.vertexCount, mesh.indexCount)) {
-            // LOG_ERROR("VoxelTerrainRenderer", "Cannot allocate space for a chunk (vertices = {} | indices = {})",
-                      // mesh.vertexCount, mesh.indexCount);
-            continue;
+    if (!m_meshArena->can_allocate(mesh.faceCount) || !m_meshArena->allocate(mesh, owner)) {
+        // the retired meshes and the defragmentation give space back over the next frames
+        if (!m_meshArenaFullLogged) {
+            LOG_WARN("VoxelTerrainRenderer", "Mesh arena full, chunk uploads wait for free space (faces = {})",
+                     mesh.faceCount);
+            m_meshArenaFullLogged = true;
         }
+        return false;
+    }
+    m_meshArenaFullLogged = false;
 
-        if (!buffer.allocate(mesh)) {
-            // LOG_ERROR("VoxelTerrainRenderer", "Failed to allocate the chunk (vertices = {} | indices = {})",
-                      // mesh.vertexCount, mesh.indexCount);
-            continue;
-        }
-        mesh.bufferIndex = i;
-
-        TerrainOUB oub = {
-            .model = {
-                1.0f, 0.0f, 0.0f, 0.0f,  // column 0
-                0.0f, 1.0f, 0.0f, 0.0f,  // column 1
-                0.0f, 0.0f, 1.0f, 0.0f,  // column 2
-                pos.x, pos.y, pos.z, 1.0f  // column 3 (translation)
-            }
-        };
-        buffer.write(cmd, mesh, oub);
-        uploaded = true;
+    mesh.uploadTicket = m_meshArena->write_mesh(cmd, *m_uploadContext, mesh);
+    if (mesh.uploadTicket == 0) {
+        // written by the frame command list, drawn from this frame
+        m_meshArena->activate(cmd, mesh.drawSlotIndex, make_chunk_oub(coord), make_chunk_bounds(coord));
+        release_previous_mesh(mesh);
     }
+    return true;
+}
 
-    if (!uploaded) {
-        LOG_WARN("VoxelTerrainRenderer", "Can't upload chunk mesh, creating new buffer");
-        create_buffer();
-        upload_chunk_mesh_system(cmd, mesh, pos);
+bool VoxelTerrainRenderer::activate_uploaded_mesh_system(nvrhi::CommandListHandle cmd, VoxelChunkMesh &mesh, const ChunkCoordinate &coord) {
+    if (!m_uploadContext->is_complete(mesh.uploadTicket)) {
+        return false;
     }
 
+    if (mesh.is_allocated()) {
+        m_meshArena->activate(cmd, mesh.drawSlotIndex, make_chunk_oub(coord), make_chunk_bounds(coord));
+    }
+    release_previous_mesh(mesh);
+    mesh.uploadTicket = 0;
     return true;
 }
 
-void VoxelTerrainRenderer::render_terrain_system(Renderer &renderer, Camera3d &camera) {
-    auto &commandList = renderer.frameContext.commandList;
+void VoxelTerrainRenderer::submit_uploads_system() {
+    m_uploadContext->submit();
+}
 
+void VoxelTerrainRenderer::release_previous_mesh(VoxelChunkMesh &mesh) {
+    if (mesh.previousDrawSlotIndex == UINT32_MAX) return;
 
-    if (camera.viewMatrix != m_ubo.view)
-        m_ubo.view = camera.viewMatrix;
-    if (camera.projectionMatrix != m_ubo.projection)
-        m_ubo.projection = camera.projectionMatrix;
+    m_meshArena->free_slot(mesh.previousDrawSlotIndex);
+    mesh.previousDrawSlotIndex = UINT32_MAX;
+}
 
+TerrainOUB VoxelTerrainRenderer::make_chunk_oub(const ChunkCoordinate &coord) {
+    return {
+        .chunkCoord = glm::ivec4(coord.x, coord.y, coord.z, 0)
+    };
+}
 
-    // Before rendering, clean up freed draw slots
-    for (auto& chunkBuffer : m_chunkBuffers) {
-        chunkBuffer.cleanup_freed_draw_slots(commandList);
+ChunkAABB VoxelTerrainRenderer::make_chunk_bounds(const ChunkCoordinate &coord) {
+    const glm::vec3 min = glm::vec3(coord) * static_cast<float>(CHUNK_SIZE);
+    return {
+        .min = min,
+        .max = min + static_cast<float>(CHUNK_SIZE)
+    };
+}
+
+void VoxelTerrainRenderer::defragment_buffers_system(flecs::world &world, nvrhi::CommandListHandle cmd) {
+    uint64_t copyBudget = DEFRAG_COPY_BUDGET_BYTES;
+    uint32_t movesLeft = DEFRAG_MAX_MOVES_PER_FRAME;
+
+    // The meshes uploaded this frame must be in their buffer before they can be moved
+    m_stagingRing->flush(cmd);
+
+    // Merge the free blocks of a fragmented arena by moving the meshes sitting between two of them
+    VoxelBuffer &arena = *m_meshArena;
+    if (!is_fragmented(arena.get_face_allocator())) return;
+
+    uint32_t slot;
+    while (copyBudget > 0 && movesLeft > 0 && arena.find_compaction_candidate(DEFRAG_MAX_SCANNED_SLOTS, slot)) {
+        MeshRelocation relocation;
+        uint64_t copied = arena.relocate(cmd, slot, arena, relocation);
+        if (copied == 0) break;
+
+        flecs::entity e = world.entity(relocation.owner);
+        auto *mesh = e.is_alive() ? e.get_mut<VoxelChunkMesh>() : nullptr;
+        if (!mesh) {
+            LOG_ERROR("VoxelTerrainRenderer", "Relocated a mesh whose entity is gone");
+        } else {
+            mesh->drawSlotIndex = relocation.drawSlotIndex;
+            mesh->faceRegionStart = relocation.faceRegionStart;
+            mesh->faceRegionCount = relocation.faceRegionCount;
+        }
+        copyBudget -= std::min(copyBudget, copied);
+        movesLeft--;
+    }
+}
+
+bool VoxelTerrainRenderer::is_fragmented(const RegionAllocator &allocator) {
+    const RegionAllocatorStats &stats = allocator.get_stats();
+    return stats.freeBlockCount >= DEFRAG_MIN_FREE_BLOCKS &&
+           allocator.get_largest_free_block() < stats.freeRegions / 2;
+}
+
+void VoxelTerrainRenderer::set_culling_mode(TerrainCullingMode mode) {
+    if (mode == TerrainCullingMode::Gpu && !m_backend->drawIndirectCountSupported) {
+        LOG_WARN("VoxelTerrainRenderer", "GPU culling needs drawIndirectCount, using CPU culling");
+        mode = TerrainCullingMode::Cpu;
+    }
+    m_cullingMode = mode;
+}
+
+void VoxelTerrainRenderer::cull_draws_gpu(nvrhi::CommandListHandle cmd, const Frustum &frustum) {
+    VoxelBuffer& buffer = *m_meshArena;
+
+    // reset the draw count, the shader appends to it
+    const uint32_t zero = 0;
+    cmd->writeBuffer(buffer.get_culled_indirect_buffer(), &zero, sizeof(uint32_t), 0);
+
+    CullPushConstants pushConstants = {};
+    for (int p = 0; p < 6; p++) {
+        pushConstants.planes[p] = frustum.planes[p];
     }
+    pushConstants.slotCount = buffer.get_draw_slot_count();
+
+    auto computeState = nvrhi::ComputeState()
+            .setPipeline(m_cullPipeline)
+            .addBindingSet(m_meshArenaCullBindingSet);
+    cmd->setComputeState(computeState);
+    cmd->setPushConstants(&pushConstants, sizeof(CullPushConstants));
+    cmd->dispatch((pushConstants.slotCount + 63) / 64, 1, 1);
+}
+
+void VoxelTerrainRenderer::render_terrain_system(Renderer &renderer, Camera3d &camera, const glm::vec3 &cameraPosition) {
+    auto &commandList = renderer.frameContext.commandList;
+
+    // Camera relative rendering: the chunk offset is computed in integers on the GPU, only the rotation is kept
+    // from the view matrix so the vertex positions never get large
+    const glm::ivec3 cameraChunk = glm::ivec3(glm::floor(cameraPosition / static_cast<float>(CHUNK_SIZE)));
+    glm::mat4 viewRotation = camera.viewMatrix;
+    viewRotation[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    m_ubo.viewProjection = camera.projectionMatrix * viewRotation;
+    m_ubo.cameraChunk = glm::ivec4(cameraChunk, 0);
+    m_ubo.cameraOffset = glm::vec4(cameraPosition - glm::vec3(cameraChunk) * static_cast<float>(CHUNK_SIZE), 0.0f);
+
+    // Record the uploads of this frame. Before the cleanup, a slot written then freed this frame must end disabled.
+    m_stagingRing->flush(commandList);
+
+    // Before rendering, clean up freed draw slots
+    m_meshArena->cleanup_freed_draw_slots(commandList);
 
     commandList->writeBuffer(
         m_uboBuffer,
         &m_ubo, sizeof(TerrainUBO));
 
+    const Frustum frustum = Frustum::from_matrix(camera.projectionMatrix * camera.viewMatrix);
+    m_visibleDrawCount = 0;
+
+    // Culled before the render pass, the GPU culling dispatch can't be recorded between the draws
+    uint32_t drawCount = 0;
+    nvrhi::BufferHandle indirectBuffer;
+    switch (m_cullingMode) {
+        case TerrainCullingMode::None:
+            drawCount = m_meshArena->get_draw_slot_count();
+            indirectBuffer = m_meshArena->get_indirect_buffer();
+            break;
+        case TerrainCullingMode::Cpu:
+            drawCount = m_meshArena->cull_draws(commandList, frustum);
+            indirectBuffer = m_meshArena->get_visible_indirect_buffer();
+            m_visibleDrawCount = drawCount;
+            break;
+        case TerrainCullingMode::Gpu:
+            // upper bound, the real count is read by the GPU from the culled indirect buffer
+            drawCount = m_meshArena->get_draw_slot_count();
+            indirectBuffer = m_meshArena->get_culled_indirect_buffer();
+            if (drawCount > 0) {
+                cull_draws_gpu(commandList, frustum);
+            }
+            break;
+    }
+
+    if (drawCount == 0) {
+        commandList->clearState();
+        return;
+    }
+
     auto extent = m_backend->get_swapchain_extent();
 
-    int i = 0;
-    for (auto& chunkBuffer : m_chunkBuffers) {
-        auto& bufferBindingSet = m_chunkBufferBindingSets[i];
-
-        auto vertexBinding = nvrhi::VertexBufferBinding()
-                .setSlot(0)
-                .setBuffer(chunkBuffer.get_mesh_buffer())
-                .setOffset(0);
-        auto indexBinding = nvrhi::IndexBufferBinding()
-                .setOffset(INDEX_SECTION_OFFSET)
-                .setBuffer(chunkBuffer.get_mesh_buffer())
-                .setFormat(nvrhi::Format::R32_UINT);
-
-        auto graphicsState = nvrhi::GraphicsState()
-                .setPipeline(m_pipeline)
-                .setViewport(nvrhi::ViewportState().addViewportAndScissorRect(nvrhi::Viewport(extent.width, extent.height)))
-                .setFramebuffer(m_backend->get_current_framebuffer())
-                .addBindingSet(m_frameBindingSet)    // Set 0: Per-frame data (camera)
-                .addBindingSet(bufferBindingSet)     // Set 1: Per-buffer data (chunks)
-                .addBindingSet(m_textureManager->get_binding_set()) // Set 2: texture array
-                .addVertexBuffer(vertexBinding)
-                .setIndirectParams(chunkBuffer.get_indirect_buffer())
-                .setIndexBuffer(indexBinding);
-        commandList->setGraphicsState(graphicsState);
-
-        uint32_t drawCount = chunkBuffer.get_draw_count();
-        if (drawCount > 0) {
-            commandList->drawIndexedIndirect(0, drawCount);
-        }
-        i++;
+    // Every chunk is in the mesh arena: one state bind and one multi-draw, whatever the number of chunks
+    // No vertex buffer, the faces are read from set 1 and every draw shares the quad index buffer
+    auto indexBinding = nvrhi::IndexBufferBinding()
+            .setOffset(0)
+            .setBuffer(m_meshArena->get_quad_index_buffer())
+            .setFormat(nvrhi::Format::R32_UINT);
+
+    auto graphicsState = nvrhi::GraphicsState()
+            .setPipeline(m_pipeline)
+            .setViewport(nvrhi::ViewportState().addViewportAndScissorRect(nvrhi::Viewport(extent.width, extent.height)))
+            .setFramebuffer(m_backend->get_current_framebuffer())
+            .addBindingSet(m_frameBindingSet)      // Set 0: Per-frame data (camera)
+            .addBindingSet(m_meshArenaBindingSet) // Set 1: Chunk data
+            .addBindingSet(m_textureManager->get_binding_set()) // Set 2: texture array
+            .setIndirectParams(indirectBuffer)
+            .setIndexBuffer(indexBinding);
+    commandList->setGraphicsState(graphicsState);
+
+    if (m_cullingMode == TerrainCullingMode::Gpu) {
+        // NVRHI has no indirect count draw, record it on the native command buffer once the state is bound
+        auto vkCommandBuffer = static_cast<VkCommandBuffer>(
+            commandList->getNativeObject(nvrhi::ObjectTypes::VK_CommandBuffer).pointer);
+        auto vkIndirectBuffer = static_cast<VkBuffer>(
+            indirectBuffer->getNativeObject(nvrhi::ObjectTypes::VK_Buffer).pointer);
+        vkCmdDrawIndexedIndirectCount(vkCommandBuffer,
+                                      vkIndirectBuffer, TERRAIN_CULLED_DRAWS_OFFSET,
+                                      vkIndirectBuffer, 0,
+                                      drawCount, sizeof(nvrhi::DrawIndexedIndirectArguments));
+    } else {
+        commandList->drawIndexedIndirect(0, drawCount);
     }
 
     commandList->clearState();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <flecs.h>
+#include <memory>
 #include <vector>
 
 #include "VoxelBuffer.h"
@@ -8,19 +9,39 @@
 #include "core/resource/ResourceSystem.h"
 #include "core/world/world_components.h"
 #include "nvrhi/nvrhi.h"
+#include "renderer/vulkan/StagingRingBuffer.h"
+#include "renderer/vulkan/UploadContext.h"
 
-struct Position;
 struct Camera3d;
 class VulkanBackend;
 struct Renderer;
 
-// UBO to store in the GPU for terrain rendering
+// UBO to store in the GPU for terrain rendering.
+// The vertices are made relative to the camera in integer chunks first, so the floats stay small far from the origin.
 struct alignas(16) TerrainUBO {
-    glm::mat4 view;
-    glm::mat4 projection{1};
+    glm::mat4 viewProjection{1}; // projection * view rotation, the camera is at the origin
+    glm::ivec4 cameraChunk{0};   // chunk containing the camera
+    glm::vec4 cameraOffset{0};   // camera position inside its chunk
     float time;
 };
 
+// How the chunk draws out of the camera frustum are removed
+enum class TerrainCullingMode {
+    None, // every draw slot is submitted
+    Cpu,  // VoxelBuffer::cull_draws, visible draws uploaded every frame
+    Gpu,  // TerrainCullChunks.comp, visible draws counted on the GPU (needs drawIndirectCount)
+};
+
+// Staging ring of the frame command list, only small writes (draw commands, OUB, bounds) and fallbacks go through it
+static constexpr uint64_t FRAME_STAGING_RING_SIZE = 4 * 1024 * 1024; // 4 MB
+
+// Mesh bytes the defragmentation may copy per frame
+static constexpr uint64_t DEFRAG_COPY_BUDGET_BYTES = 1024 * 1024; // 1 MB
+static constexpr uint32_t DEFRAG_MAX_MOVES_PER_FRAME = 32;
+static constexpr uint32_t DEFRAG_MAX_SCANNED_SLOTS = 256;
+// The arena is compacted when it has this many free blocks and the largest is less than half of the free space
+static constexpr uint32_t DEFRAG_MIN_FREE_BLOCKS = 8;
+
 class VoxelTerrainRenderer {
 public:
     VoxelTerrainRenderer(VulkanBackend* backend, ResourceSystem* resourceSystem, VoxelTextureManager* textureManager);
@@ -29,6 +50,12 @@ public:
     // create instance and register components/systems in the ECS
     static void Register(flecs::world& ecs);
 
+    /**
+     * Culling used by the next frames. Gpu falls back to Cpu if the device doesn't support drawIndirectCount.
+     */
+    void set_culling_mode(TerrainCullingMode mode);
+    TerrainCullingMode get_culling_mode() const { return m_cullingMode; }
+
 private:
     VulkanBackend* m_backend;
     ResourceSystem* m_resourceSystem;
@@ -36,36 +63,94 @@ private:
 
     // UBO
     nvrhi::BufferHandle m_uboBuffer;
-    TerrainUBO m_ubo; // CPU-side copy of the UBO. Will be use to know when to update the GPU UBO. (compare the camera entity value with this one)
+    TerrainUBO m_ubo; // CPU-side copy of the UBO, rebuilt from the camera every frame
 
     // Set 0: Per-frame bindings (camera/view data)
     nvrhi::BindingLayoutHandle m_frameBindingLayout;
     nvrhi::BindingSetHandle m_frameBindingSet;
 
-    // Set 1: Per-buffer bindings (chunk data)
+    // Writes of the frame command list, flushed once per frame before the buffers are read
+    std::unique_ptr<StagingRingBuffer> m_stagingRing;
+    // Chunk mesh data, uploaded outside of the frame (transfer queue when available)
+    std::unique_ptr<UploadContext> m_uploadContext;
+
+    // Set 1: Chunk data bindings
     nvrhi::BindingLayoutHandle m_bufferBindingLayout;
-    std::vector<VoxelBuffer> m_chunkBuffers;
-    std::vector<nvrhi::BindingSetHandle> m_chunkBufferBindingSets; // One binding set per VoxelBuffer
+    // Every chunk mesh is sub-allocated in this buffer, the terrain is drawn with one state bind and one multi-draw
+    std::unique_ptr<VoxelBuffer> m_meshArena;
+    nvrhi::BindingSetHandle m_meshArenaBindingSet;
+    bool m_meshArenaFullLogged = false;
 
     nvrhi::ShaderHandle m_vertexShader;
     nvrhi::ShaderHandle m_pixelShader;
 
     nvrhi::GraphicsPipelineHandle m_pipeline;
 
+    // GPU culling compute pass over the draw slots of the mesh arena
+    struct CullPushConstants {
+        glm::vec4 planes[6];
+        uint32_t slotCount;
+    };
+    nvrhi::ShaderHandle m_cullShader;
+    nvrhi::BindingLayoutHandle m_cullBindingLayout;
+    nvrhi::BindingSetHandle m_meshArenaCullBindingSet;
+    nvrhi::ComputePipelineHandle m_cullPipeline;
+
+    TerrainCullingMode m_cullingMode = TerrainCullingMode::Cpu;
+    // Chunks that passed the CPU frustum culling in the last frame
+    uint32_t m_visibleDrawCount = 0;
+
     void init();
+    void init_culling_pipeline();
     void destroy();
 
+    /**
+     * Start the uploads of the frame: give back the staging space of the finished frames and uploads
+     */
+    void begin_uploads_system();
+
+    /**
+     * Allocate and upload a built mesh. The previous mesh of the chunk keeps being drawn until the new one is active.
+     * mesh.uploadTicket is set to the ticket of the upload context to wait for before activate_uploaded_mesh_system,
+     * 0 if the mesh is already active.
+     * @return False if the mesh arena is full, the upload is retried on the next frame
+     */
     bool upload_chunk_mesh_system(
-        nvrhi::CommandListHandle cmd,
-        VoxelChunkMesh &mesh, const Position &pos);
+        nvrhi::CommandListHandle cmd, flecs::entity_t owner,
+        VoxelChunkMesh &mesh, const ChunkCoordinate &coord);
+
+    /**
+     * Enable the draw of a mesh whose upload is complete, and release the previous mesh of the chunk
+     * @return True if the mesh is active, false if its upload is still in flight
+     */
+    bool activate_uploaded_mesh_system(nvrhi::CommandListHandle cmd, VoxelChunkMesh &mesh, const ChunkCoordinate &coord);
+
+    void submit_uploads_system();
+
+    void release_previous_mesh(VoxelChunkMesh &mesh);
+    static TerrainOUB make_chunk_oub(const ChunkCoordinate &coord);
+    static ChunkAABB make_chunk_bounds(const ChunkCoordinate &coord);
+
+    /**
+     * Incremental defragmentation, within DEFRAG_COPY_BUDGET_BYTES of GPU copies per frame:
+     * compacts the mesh arena when it is fragmented. The moved VoxelChunkMesh are patched.
+     */
+    void defragment_buffers_system(flecs::world &world, nvrhi::CommandListHandle cmd);
+    static bool is_fragmented(const RegionAllocator &allocator);
 
     void render_terrain_system(
         Renderer &renderer,
-        Camera3d &camera);
+        Camera3d &camera,
+        const glm::vec3 &cameraPosition);
 
-    VoxelBuffer &create_buffer();
+    /**
+     * Record the GPU culling of the mesh arena, filling its culled indirect buffer
+     */
+    void cull_draws_gpu(nvrhi::CommandListHandle cmd, const Frustum &frustum);
 
 public:
     // Debug accessor for buffer visualization
-    const std::vector<VoxelBuffer>& get_voxel_buffers() const { return m_chunkBuffers; }
+    const VoxelBuffer& get_mesh_arena() const { return *m_meshArena; }
+    uint32_t get_visible_draw_count() const { return m_visibleDrawCount; }
+    const UploadContext& get_upload_context() const { return *m_uploadContext; }
 };
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "../../../cmake-build-debug/_deps/nvrhi-src/src/vulkan/vulkan-backend.h"
 #include "core/GameState.h"
 #include "core/log/Logger.h"
+#include "core/task/FrameBudget.h"
 #include "renderer/Renderer.h"
 
 VoxelTextureManager::VoxelTextureManager(VulkanBackend* backend, ResourceSystem* resourceSystem) {
@@ -47,12 +48,13 @@ void VoxelTextureManager::Register(flecs::world &ecs) {
 
     ecs.emplace<VoxelTextureManager>(backend, gameState->resourceSystem.get());
     auto* textureManager = ecs.get_mut<VoxelTextureManager>();
+    auto* frameBudget = ecs.get_mut<FrameBudget>();
 
     ecs.system<Renderer>("UploadVoxelTexturesSystem")
         .kind(flecs::PreStore)
-        .each([textureManager](flecs::entity e, Renderer& renderer) {
+        .each([textureManager, frameBudget](flecs::entity e, Renderer& renderer) {
             auto* gameState = e.world().get<GameState>();
-            textureManager->upload_pending_textures_system(renderer, gameState->resourceSystem.get());
+            textureManager->upload_pending_textures_system(renderer, gameState->resourceSystem.get(), *frameBudget);
         });
 }
 
@@ -211,7 +213,8 @@ void VoxelTextureManager::generate_mipmaps(nvrhi::CommandListHandle cmd, uint32_
     //                      nvrhi::ResourceStates::ShaderResource);
 }
 
-void VoxelTextureManager::upload_pending_textures_system(Renderer &renderer, ResourceSystem* resourceSys) {
+void VoxelTextureManager::upload_pending_textures_system(Renderer &renderer, ResourceSystem* resourceSys,
+                                                         FrameBudget &frameBudget) {
       if (m_toUploadList.empty()) return;
 
       auto& cmd = renderer.frameContext.commandList;
@@ -221,7 +224,13 @@ void VoxelTextureManager::upload_pending_textures_system(Renderer &renderer, Res
 
       constexpr size_t rowPitch = 32 * 4; // RGBA8: width * 4 bytes
 
-      for (const AssetID assetId : m_toUploadList) {
+      // the textures not uploaded in this frame's budget stay at the front of the list
+      size_t uploadedCount = 0;
+      for (; uploadedCount < m_toUploadList.size(); uploadedCount++) {
+          if (!frameBudget.has_time_for(FrameBudgetStage::TextureUpload)) break;
+
+          FrameBudgetScope budgetScope(frameBudget, FrameBudgetStage::TextureUpload);
+          const AssetID assetId = m_toUploadList[uploadedCount];
           std::string assetIdStr = resourceSys->get_asset_registry()->get_debug_name(assetId);
           auto it = m_textures.find(assetId);
           if (it == m_textures.end()) {
@@ -269,5 +278,5 @@ void VoxelTextureManager::upload_pending_textures_system(Renderer &renderer, Res
       cmd->setTextureState(m_textureArray, nvrhi::AllSubresources,
                            nvrhi::ResourceStates::ShaderResource);
 
-      m_toUploadList.clear();
+      m_toUploadList.erase(m_toUploadList.begin(), m_toUploadList.begin() + static_cast<ptrdiff_t>(uploadedCount));
   }
@@ -9,6 +9,7 @@
 #define MAX_VOXEL_TEXTURE_SLOTS 1024
 
 struct Renderer;
+class FrameBudget;
 
 struct VoxelTextureSlot {
     AssetID textureID = 0; // used to track if this slot is used
@@ -74,9 +75,9 @@ private:
     void generate_mipmaps(nvrhi::CommandListHandle cmd, uint32_t textureSlot);
 
     /**
-     * Will upload any pending textures to the GPU texture array
+     * Will upload the pending textures to the GPU texture array, as many as the frame budget allows
      */
-    void upload_pending_textures_system(Renderer& renderer, ResourceSystem* resourceSys);
+    void upload_pending_textures_system(Renderer& renderer, ResourceSystem* resourceSys, FrameBudget& frameBudget);
 
     std::vector<VoxelTextureSlot> m_slots;
     std::unordered_map<AssetID, uint32_t> m_textures; // Map from texture ID to slot index
@@ -0,0 +1,104 @@
+#include "ServerModule.h"
+
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+#include <glm/glm.hpp>
+
+#include "core/GameState.h"
+#include "core/main_components.h"
+#include "core/log/Logger.h"
+#include "core/task/FrameBudget.h"
+#include "core/world/ChunkManager.h"
+#include "core/world/world_components.h"
+
+namespace {
+    // Random horizontal velocity of the loader speed
+    Velocity random_velocity(std::mt19937& rng, float speed) {
+        std::uniform_real_distribution<float> angle(0.0f, 2.0f * std::numbers::pi_v<float>);
+        const float a = angle(rng);
+        return Velocity(std::cos(a) * speed, 0.0f, std::sin(a) * speed);
+    }
+}
+
+ServerModule::ServerModule(flecs::world &ecs) {
+    if (!ecs.get<GameState>()) {
+        throw std::runtime_error("ServerModule: CoreModule must be imported before ServerModule");
+    }
+
+    if (!ecs.get<ServerConfig>()) {
+        ecs.set<ServerConfig>({});
+    }
+    ecs.emplace<ServerState>();
+    const ServerConfig config = *ecs.get<ServerConfig>();
+
+    // the streaming work of a tick may use what the tick leaves, there is no rendering to keep room for
+    auto* frameBudget = ecs.get_mut<FrameBudget>();
+    frameBudget->set_target_frame_time(1000.0 / config.tickRate);
+    frameBudget->set_max_budget_fraction(0.9);
+
+    ecs.system<Position, Velocity, SimulatedLoader>("SimulatedLoaderMovementSystem")
+        .kind(flecs::PreUpdate)
+        .each([](flecs::entity e, Position& pos, Velocity& velocity, SimulatedLoader& loader) {
+            flecs::world world = e.world();
+            const float deltaTime = static_cast<float>(world.get<GameState>()->deltaTime);
+
+            loader.turnTimer -= deltaTime;
+            if (loader.turnTimer <= 0.0f) {
+                auto* state = world.get_mut<ServerState>();
+                std::uniform_real_distribution<float> turnDelay(5.0f, 15.0f);
+                velocity = random_velocity(state->rng, world.get<ServerConfig>()->loaderSpeed);
+                loader.turnTimer = turnDelay(state->rng);
+            }
+
+            pos += velocity * deltaTime;
+        });
+
+    ecs.system("ServerStatsSystem")
+        .kind(flecs::PostFrame)
+        .run([](flecs::iter& it) {
+            flecs::world world = it.world();
+            auto* state = world.get_mut<ServerState>();
+            const auto* config = world.get<ServerConfig>();
+            const auto* chunkManager = world.get<ChunkManager>();
+            const auto* gameState = world.get<GameState>();
+            if (!state || !config || !chunkManager || !gameState) return;
+
+            state->sinceStats += gameState->deltaTime;
+            if (state->sinceStats < config->statsInterval) return;
+
+            const uint64_t generated = chunkManager->get_generated_count();
+            const uint64_t loaded = chunkManager->get_loaded_count();
+            LOG_INFO("Server", "{:.1f} chunks/s generated, {:.1f} chunks/s loaded, {} chunks tracked, {} queued",
+                     static_cast<double>(generated - state->generatedAtLastStats) / state->sinceStats,
+                     static_cast<double>(loaded - state->loadedAtLastStats) / state->sinceStats,
+                     chunkManager->get_chunk_count(), chunkManager->get_load_queue_size());
+
+            state->generatedAtLastStats = generated;
+            state->loadedAtLastStats = loaded;
+            state->sinceStats = 0.0;
+        });
+
+    // spawn the loaders
+    auto* state = ecs.get_mut<ServerState>();
+    std::uniform_real_distribution<float> spawn(-config.spawnSpread * 0.5f, config.spawnSpread * 0.5f);
+    for (int i = 0; i < config.loaderCount; i++) {
+        ecs.entity()
+            .set<Position>({spawn(state->rng), config.spawnHeight, spawn(state->rng)})
+            .set<Velocity>(random_velocity(state->rng, config.loaderSpeed))
+            .set<ChunkLoader>({
+                .loadRadius = config.loadRadius,
+                .unloadRadius = config.loadRadius + 2
+            })
+            .set<SimulatedLoader>({});
+    }
+
+    LOG_INFO("Server", "{} simulated loaders, load radius {}, {} ticks/s",
+             config.loaderCount, config.loadRadius, config.tickRate);
+}
+
+void shutdown_server(flecs::world &ecs) {
+    LOG_INFO("ServerModule", "Shutting down...");
+    // release the chunks of the simulated loaders while the ChunkManager is still alive
+    ecs.delete_with<SimulatedLoader>();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <flecs.h>
+#include <random>
+
+// Set before importing the ServerModule to change the defaults
+struct ServerConfig {
+    double tickRate = 20.0; // ticks per second
+
+    // Loaders wandering in the world, standing for the players
+    int loaderCount = 16;
+    int loadRadius = 8;
+    float loaderSpeed = 20.0f;   // world units per second
+    float spawnSpread = 2048.0f; // loaders start in a square of this size around the origin
+    float spawnHeight = 120.0f;
+
+    double statsInterval = 5.0; // seconds between two chunk throughput logs
+};
+
+// Loader moved by the server, it turns to a random horizontal direction from time to time
+struct SimulatedLoader {
+    float turnTimer = 0.0f; // seconds until the next turn
+};
+
+struct ServerState {
+    std::mt19937 rng{12345};
+
+    double sinceStats = 0.0;
+    uint64_t generatedAtLastStats = 0;
+    uint64_t loadedAtLastStats = 0;
+};
+
+/**
+ * Responsible for the headless server systems: simulated loaders and chunk throughput stats.
+ * Only needs the CoreModule, the ticks are driven by server_main.
+ */
+struct ServerModule {
+    ServerModule(flecs::world& ecs);
+};
+
+void shutdown_server(flecs::world& ecs);
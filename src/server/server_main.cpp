@@ -0,0 +1,69 @@
+#include "core/CoreModule.h"
+#include "core/GameState.h"
+#include "core/log/Logger.h"
+#include "core/task/TaskScheduler.h"
+#include "server/ServerModule.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <flecs.h>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+namespace {
+    std::atomic<bool> g_stopRequested = false;
+
+    void request_stop(int) {
+        g_stopRequested = true;
+    }
+}
+
+int main() {
+    try {
+        auto ecs = std::make_unique<flecs::world>();
+
+        // no render or driver thread: only the tick thread keeps a core, the workers are pinned to the others
+        ecs->set<TaskSchedulerConfig>({
+            .reservedCores = 1,
+            .pinWorkers = true
+        });
+
+        ecs->import<CoreModule>();
+        ecs->import<ServerModule>();
+
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+
+        // Fixed tick, on its own clock. A late tick is not caught up with a burst of ticks.
+        const double tickSeconds = 1.0 / ecs->get<ServerConfig>()->tickRate;
+        const auto tickDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(tickSeconds));
+        auto nextTick = std::chrono::steady_clock::now();
+
+        while (!g_stopRequested && ecs->get<GameState>()->isRunning) {
+            auto* gameState = ecs->get_mut<GameState>();
+            gameState->deltaTime = tickSeconds;
+            gameState->lastTime = get_time_seconds();
+
+            ecs->progress(static_cast<float>(tickSeconds));
+
+            nextTick += tickDuration;
+            const auto now = std::chrono::steady_clock::now();
+            if (nextTick < now) {
+                nextTick = now;
+            } else {
+                std::this_thread::sleep_until(nextTick);
+            }
+        }
+
+        shutdown_server(*ecs);
+        shutdown_core(*ecs);
+
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}